@@ -18,27 +18,27 @@
  * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 
 #include "pgq.h"
+#include "pgq_internal.h"
 
+/* Query buffer and error state are per thread, so different connections may be used concurrently */
 #define MAX_QUERY_SIZE 1024
-static char query[MAX_QUERY_SIZE];
+static _Thread_local char query[MAX_QUERY_SIZE];
 
-static int error_number = 0;
+static _Thread_local int error_number = 0;
 #define MAX_ERROR_SIZE 1024
-static char error_text[MAX_ERROR_SIZE];
+static _Thread_local char error_text[MAX_ERROR_SIZE];
 
 static const char* INCORRECT_AMOUNT_OF_COLUMNS_ERR = "Incorrect amount of columns, awaited: %d, retreived: %d";
 static const char* INCORRECT_AMOUNT_OF_RAWS_ERR = "Incorrect amount of raws, awaited: %d, retreived: %d";
-static const char* MEMORY_ALLOC_ERR = "Could not allocate %d bytes";
 static const char* TYPE_INTERVAL_ERROR = "Variable %s is not 'interval', value: %s";
 static const char* TYPE_TIMESTAMP_ERROR = "Variable %s is not 'timestamp', value: %s";
 
-#define ARRAY_SIZE(array) (sizeof(array)/sizeof(array[0]))
-
 /* PgQ queries */
 static const char* GET_VERSION_QUERY = "select pgq.version()";
 static const char* CREATE_QUEUE_QUERY = "select pgq.create_queue('%s')";
@@ -50,13 +50,23 @@ static const char* GET_QUEUE_INFO_QUERY = "select * from pgq.get_queue_info()";
 
 static const char* INSERT_EVENT_QUERY = "select pgq.insert_event('%s', '%s', '%s')";
 static const char* INSERT_EVENT_EX_QUERY = "select pgq.insert_event('%s', '%s', '%s', '%s', '%s', '%s', '%s')";
+static const char* INSERT_EVENT_STAMPED_QUERY = "select pgq.insert_event('%s', '%s', '%s', %s, %s, %s, %s)";
+static const char* INSERT_EVENTS_QUERY_HEAD = "select pgq.insert_event('%s', ev_type, ev_data, ev_extra1, ev_extra2, ev_extra3, ev_extra4)"
+    " from (values ";
+static const char* INSERT_EVENTS_QUERY_TAIL = ") as ev(ev_type, ev_data, ev_extra1, ev_extra2, ev_extra3, ev_extra4)";
+static const char* TICKER_QUERY = "select pgq.ticker('%s')";
 static const char* REGISTER_CONSUMER_QUERY = "select pgq.register_consumer('%s', '%s')";
+static const char* REGISTER_CONSUMER_AT_QUERY = "select pgq.register_consumer_at('%s', '%s', %ld)";
 static const char* UNREGISTER_CONSUMER_QUERY = "select pgq.unregister_consumer('%s', '%s')";
 
 #define GET_CONSUMER_INFO_COLUMNS 8
 static const char* GET_CONSUMER_INFO_QUERY = "select * from pgq.get_consumer_info('%s', '%s')";
 static const char* GET_CONSUMERS_INFO_QUERY = "select * from pgq.get_consumer_info('%s')";
 
+static const char* GET_QUEUE_TICKS_QUERY = "select t.tick_id from pgq.tick t, pgq.queue q"
+    " where q.queue_name = '%s' and t.tick_queue = q.queue_id and t.tick_id >= %ld and t.tick_id <= %ld"
+    " order by t.tick_id";
+
 static const char* NEXT_BATCH_QUERY = "select pgq.next_batch('%s', '%s')";
 static const char* BATCH_RETRY_QUERY = "select pgq.batch_retry(%ld, %d)";
 
@@ -95,6 +105,14 @@ const char* get_error_text() {
   return error_text;
 }
 
+void set_error(int number, const char* format, ...) {
+  va_list args;
+  error_number = number;
+  va_start(args, format);
+  vsnprintf(error_text, ARRAY_SIZE(error_text), format, args);
+  va_end(args);
+}
+
 void print_queue_info(FILE* f, queue_info_t* info) {
   char temp[256];
   fprintf(f, "queue name:           %s\n",  info->name);
@@ -228,7 +246,7 @@ int get_queues_info(PGconn* conn, queue_info_t** queues_info) {
     }
     *queues_info = (queue_info_t*)malloc(size*sizeof(queue_info_t));
     if (!*queues_info) {
-      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, size*sizeof(queue_info_t));
+      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)(size*sizeof(queue_info_t)));
       PQclear(result);
       return -3;
     }
@@ -257,22 +275,156 @@ int get_queues_info(PGconn* conn, queue_info_t** queues_info) {
 }
 
 long insert_event(PGconn* conn, const char* queue_name, const char* ev_type, const char* ev_data) {
-  snprintf(query, ARRAY_SIZE(query), INSERT_EVENT_QUERY, queue_name, queue_name, ev_type, ev_data);
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  char literal[MAX_LATENCY_STAMP_LENGTH + 2];
+  const char* extras[4] = { NULL, NULL, NULL, NULL };
+  int i;
+
+  stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+  for (i = 0; i < 4 && !extras[i]; ++i)
+    ;
+  if (i == 4) {
+    snprintf(query, ARRAY_SIZE(query), INSERT_EVENT_QUERY, queue_name, ev_type, ev_data);
+    return execute_and_get_long_result(conn, query);
+  }
+  /* extras other than the stamp stay NULL, as without tracking */
+  snprintf(literal, ARRAY_SIZE(literal), "'%s'", stamp);
+  for (i = 0; i < 4; ++i)
+    extras[i] = extras[i] ? literal : "null";
+  snprintf(query, ARRAY_SIZE(query), INSERT_EVENT_STAMPED_QUERY, queue_name, ev_type, ev_data,
+      extras[0], extras[1], extras[2], extras[3]);
   return execute_and_get_long_result(conn, query);
 }
 
 long insert_event_ex(PGconn* conn, const char* queue_name, const char* ev_type, const char* ev_data,
     const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
-  snprintf(query, ARRAY_SIZE(query), INSERT_EVENT_EX_QUERY, queue_name, queue_name, ev_type, ev_data,
-      extra1, extra2, extra3, extra4);
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  const char* extras[4];
+
+  extras[0] = extra1;
+  extras[1] = extra2;
+  extras[2] = extra3;
+  extras[3] = extra4;
+  stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+  snprintf(query, ARRAY_SIZE(query), INSERT_EVENT_EX_QUERY, queue_name, ev_type, ev_data,
+      extras[0], extras[1], extras[2], extras[3]);
   return execute_and_get_long_result(conn, query);
 }
 
+/* Length of query argument, NULL is counted as empty */
+static size_t arg_length(const char* arg) {
+  return arg ? strlen(arg) : 0;
+}
+
+size_t insert_event_data_room(const char* queue_name, const char* ev_type,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  /* the longest template without its 7 placeholders, room for latency stamp and NULL literals */
+  size_t used = strlen(INSERT_EVENT_EX_QUERY) - 7 * 2 + 1 + MAX_LATENCY_STAMP_LENGTH + 4 * strlen("null")
+      + arg_length(queue_name) + arg_length(ev_type)
+      + arg_length(extra1) + arg_length(extra2) + arg_length(extra3) + arg_length(extra4);
+  return used < ARRAY_SIZE(query) ? ARRAY_SIZE(query) - used : 0;
+}
+
+/*
+Appends text value as escaped SQL literal, empty string is stored as NULL like in insert_event().
+Sets 'failed' if value could not be escaped, e.g. has invalid multibyte characters.
+*/
+static char* append_literal(PGconn* conn, char* dst, const char* value, int* failed) {
+  int error = 0;
+  if (!*value)
+    return dst + sprintf(dst, "null");
+  *dst++ = '\'';
+  dst += PQescapeStringConn(conn, dst, value, strlen(value), &error);
+  *dst++ = '\'';
+  if (error)
+    *failed = 1;
+  return dst;
+}
+
+int insert_events(PGconn* conn, const char* queue_name, const event_t* events, int count, event_id_t* event_ids) {
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  const char* extras[4];
+  int size = -1, i, failed = 0;
+  size_t query_size;
+  char* bulk_query;
+  char* pos;
+  PGresult* result;
+
+  if (count <= 0)
+    return 0;
+  /* every row is at most 6 quoted values, escaping may double them, plus separating chars and parens */
+  query_size = strlen(INSERT_EVENTS_QUERY_HEAD) + strlen(queue_name) + strlen(INSERT_EVENTS_QUERY_TAIL) + 1
+      + count * (2 * (sizeof(events->type) + sizeof(events->data) + 4 * sizeof(events->extra1)) + 6 * 4 + 4);
+  bulk_query = (char*)malloc(query_size);
+  if (!bulk_query) {
+    snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)query_size);
+    return -3;
+  }
+  pos = bulk_query + sprintf(bulk_query, INSERT_EVENTS_QUERY_HEAD, queue_name);
+  for (i = 0; i < count; ++i) {
+    extras[0] = events[i].extra1;
+    extras[1] = events[i].extra2;
+    extras[2] = events[i].extra3;
+    extras[3] = events[i].extra4;
+    stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+    if (i > 0)
+      *pos++ = ',';
+    *pos++ = '(';
+    pos = append_literal(conn, pos, events[i].type, &failed);
+    *pos++ = ',';
+    pos = append_literal(conn, pos, events[i].data, &failed);
+    *pos++ = ',';
+    pos = append_literal(conn, pos, extras[0], &failed);
+    *pos++ = ',';
+    pos = append_literal(conn, pos, extras[1], &failed);
+    *pos++ = ',';
+    pos = append_literal(conn, pos, extras[2], &failed);
+    *pos++ = ',';
+    pos = append_literal(conn, pos, extras[3], &failed);
+    *pos++ = ')';
+  }
+  strcpy(pos, INSERT_EVENTS_QUERY_TAIL);
+  if (failed) {
+    free(bulk_query);
+    set_error(0, "%s", PQerrorMessage(conn));
+    return -1;
+  }
+
+  result = PQexec(conn, bulk_query);
+  free(bulk_query);
+  if (PQresultStatus(result) == PGRES_TUPLES_OK) {
+    size = PQntuples(result);
+    if (size != count) {
+      snprintf(error_text, ARRAY_SIZE(error_text), INCORRECT_AMOUNT_OF_RAWS_ERR, count, size);
+      PQclear(result);
+      return -2;
+    }
+    for (i = 0; i < size && event_ids; ++i) {
+      event_ids[i] = (event_id_t)atol(PQgetvalue(result, i, 0));
+    }
+  } else {
+    error_number = PQresultStatus(result);
+    strncpy(error_text, PQresultErrorMessage(result), ARRAY_SIZE(error_text));
+  }
+  PQclear(result);
+  return size;
+}
+
+tick_id_t ticker(PGconn* conn, const char* queue_name) {
+  snprintf(query, ARRAY_SIZE(query), TICKER_QUERY, queue_name);
+  return (tick_id_t)execute_and_get_long_result(conn, query);
+}
+
 int register_consumer(PGconn* conn, const char* queue_name, const char* consumer_name) {
   snprintf(query, ARRAY_SIZE(query), REGISTER_CONSUMER_QUERY, queue_name, consumer_name);
   return execute_and_get_int_result(conn, query);
 }
 
+int register_consumer_at(PGconn* conn, const char* queue_name, const char* consumer_name, tick_id_t tick_pos) {
+  snprintf(query, ARRAY_SIZE(query), REGISTER_CONSUMER_AT_QUERY, queue_name, consumer_name, tick_pos);
+  return execute_and_get_int_result(conn, query);
+}
+
 int unregister_consumer(PGconn* conn, const char* queue_name, const char* consumer_name) {
   snprintf(query, ARRAY_SIZE(query), UNREGISTER_CONSUMER_QUERY, queue_name, consumer_name);
   return execute_and_get_int_result(conn, query);
@@ -296,7 +448,7 @@ int get_consumer_info(PGconn* conn, const char* queue_name, const char* consumer
     }
     *consumer_info = (consumer_info_t*)malloc(size*sizeof(consumer_info_t));
     if (!*consumer_info) {
-      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, size*sizeof(consumer_info_t));
+      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)(size*sizeof(consumer_info_t)));
       PQclear(result);
       return -3;
     }
@@ -336,7 +488,7 @@ int get_consumers_info(PGconn* conn, const char* queue_name, consumer_info_t** c
     }
     *consumers_info = (consumer_info_t*)malloc(size*sizeof(consumer_info_t));
     if (!*consumers_info) {
-      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, size*sizeof(consumer_info_t));
+      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)(size*sizeof(consumer_info_t)));
       PQclear(result);
       return -3;
     }
@@ -358,6 +510,31 @@ int get_consumers_info(PGconn* conn, const char* queue_name, consumer_info_t** c
   return size;
 }
 
+int get_queue_ticks(PGconn* conn, const char* queue_name, tick_id_t from_tick, tick_id_t to_tick, tick_id_t** ticks) {
+  int size = -1, i;
+  PGresult* result;
+
+  snprintf(query, ARRAY_SIZE(query), GET_QUEUE_TICKS_QUERY, queue_name, from_tick, to_tick);
+  result = PQexec(conn, query);
+  if (PQresultStatus(result) == PGRES_TUPLES_OK) {
+    size = PQntuples(result);
+    *ticks = (tick_id_t*)malloc(size*sizeof(tick_id_t));
+    if (!*ticks) {
+      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)(size*sizeof(tick_id_t)));
+      PQclear(result);
+      return -3;
+    }
+    for (i = 0; i < size; ++i) {
+      (*ticks)[i] = (tick_id_t)atol(PQgetvalue(result, i, 0));
+    }
+  } else {
+    error_number = PQresultStatus(result);
+    strncpy(error_text, PQresultErrorMessage(result), ARRAY_SIZE(error_text));
+  }
+  PQclear(result);
+  return size;
+}
+
 batch_id_t next_batch(PGconn* conn, const char* queue_name, const char* consumer_name) {
   snprintf(query, ARRAY_SIZE(query), NEXT_BATCH_QUERY, queue_name, consumer_name);
   return (batch_id_t)execute_and_get_long_result(conn, query);
@@ -385,7 +562,7 @@ int get_batch_events(PGconn* conn, int64_t batch_id, event_t** events) {
     }
     *events = (event_t*)malloc(size*sizeof(event_t));
     if (!*events) {
-      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, size*sizeof(event_t));
+      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)(size*sizeof(event_t)));
       PQclear(result);
       return -3;
     }
@@ -433,7 +610,7 @@ int get_batch_info(PGconn* conn, batch_id_t batch_id, batch_info_t** batch_info)
     }
     *batch_info = (batch_info_t*)malloc(sizeof(batch_info_t));
     if (!*batch_info) {
-      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, sizeof(batch_info_t));
+      snprintf(error_text, ARRAY_SIZE(error_text), MEMORY_ALLOC_ERR, (int)sizeof(batch_info_t));
       PQclear(result);
       return -3;
     }
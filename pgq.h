@@ -42,6 +42,11 @@ typedef int64_t   seq_t;
 extern "C" {
 #endif
 
+/*
+Error state is kept per thread. Functions may be called from several threads concurrently
+as long as each thread uses its own connection.
+*/
+
 /* Returns error number which occured during last call */
 extern int get_error_number();
 /* Returns text of error which occured during last call */
@@ -99,6 +104,12 @@ extern event_id_t insert_event(PGconn* conn, const char* queue_name, const char*
 extern event_id_t insert_event_ex(PGconn* conn, const char* queue_name, const char* ev_type, const char* ev_data,
     const char* extra1, const char* extra2, const char* extra3, const char* extra4);
 
+/*
+Creates new tick on the queue, normally this is done by ticker daemon (pgqd).
+Returns id of new tick or -1 if fails
+*/
+extern tick_id_t ticker(PGconn* conn, const char* queue_name);
+
 /*
 Attaches this consumer to particular event queue.
 Returns
@@ -108,6 +119,16 @@ Returns
 */
 extern int register_consumer(PGconn* conn, const char* queue_name, const char* consumer_name);
 
+/*
+Attaches this consumer to particular event queue at position 'tick_pos'.
+If the consumer is already attached its position is moved to 'tick_pos'.
+Returns
+  0  - if the consumer was already attached
+  1  - if it is new attachment
+  -1 - if fails
+*/
+extern int register_consumer_at(PGconn* conn, const char* queue_name, const char* consumer_name, tick_id_t tick_pos);
+
 /*
 Unregister and drop resources allocated to customer.
 Returns
@@ -140,6 +161,15 @@ extern int get_consumers_info(PGconn* conn, const char* queue_name, consumer_inf
 
 extern int get_consumer_info(PGconn* conn, const char* queue_name, const char* consumer_name, consumer_info_t** consumer_info);
 
+/*
+As an output param 'ticks' returns ids of existing ticks of the queue between 'from_tick' and 'to_tick' inclusive.
+Returns
+  N  - amount of ticks stored in array (memory is allocated into this function)
+  -1 - if DB operation fails
+  -3 - if memory allocation unsuccess
+*/
+extern int get_queue_ticks(PGconn* conn, const char* queue_name, tick_id_t from_tick, tick_id_t to_tick, tick_id_t** ticks);
+
 /*
 Allocates next batch of events to consumer.
 Returns batch id, to be used in processing functions. If no batches are available, returns 0. That means that the ticker has not cut them yet. This is the appropriate moment for consumer to sleep.
@@ -170,6 +200,19 @@ typedef struct {
 
 extern void print_event(FILE* f, event_t* event);
 
+/*
+Generates 'count' events in one statement (and therefore in one transaction).
+Only type, data and extra fields of 'events' are used, empty extra fields are stored as NULL.
+Values are escaped, so they may contain quotes.
+If 'event_ids' is not NULL it receives ids of generated events in the same order.
+Returns
+  N  - amount of generated events
+  -1 - if DB operation fails or a value could not be escaped
+  -2 - if amount of generated events is not as expected
+  -3 - if memory allocation unsuccess
+*/
+extern int insert_events(PGconn* conn, const char* queue_name, const event_t* events, int count, event_id_t* event_ids);
+
 /*
 As an output param 'events' returns set of events in this batch.
 There may be no events in the batch. This is normal. The batch must still be closed with pgq.finish_batch().
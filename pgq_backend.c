@@ -0,0 +1,161 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "pgq_backend.h"
+
+static int pg_create_queue(void* ctx, const char* queue_name) {
+  return create_queue((PGconn*)ctx, queue_name);
+}
+
+static int pg_drop_queue(void* ctx, const char* queue_name, int force) {
+  return force ? drop_queue_force((PGconn*)ctx, queue_name) : drop_queue((PGconn*)ctx, queue_name);
+}
+
+static event_id_t pg_insert_event(void* ctx, const char* queue_name, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  if (!extra1 && !extra2 && !extra3 && !extra4)
+    return insert_event((PGconn*)ctx, queue_name, ev_type, ev_data);
+  return insert_event_ex((PGconn*)ctx, queue_name, ev_type, ev_data,
+      extra1 ? extra1 : "", extra2 ? extra2 : "", extra3 ? extra3 : "", extra4 ? extra4 : "");
+}
+
+static tick_id_t pg_tick(void* ctx, const char* queue_name) {
+  return ticker((PGconn*)ctx, queue_name);
+}
+
+static int pg_register_consumer(void* ctx, const char* queue_name, const char* consumer_name) {
+  return register_consumer((PGconn*)ctx, queue_name, consumer_name);
+}
+
+static int pg_unregister_consumer(void* ctx, const char* queue_name, const char* consumer_name) {
+  return unregister_consumer((PGconn*)ctx, queue_name, consumer_name);
+}
+
+static batch_id_t pg_next_batch(void* ctx, const char* queue_name, const char* consumer_name) {
+  return next_batch((PGconn*)ctx, queue_name, consumer_name);
+}
+
+static int pg_get_batch_events(void* ctx, batch_id_t batch_id, event_t** events) {
+  return get_batch_events((PGconn*)ctx, batch_id, events);
+}
+
+static int pg_get_batch_info(void* ctx, batch_id_t batch_id, batch_info_t** batch_info) {
+  return get_batch_info((PGconn*)ctx, batch_id, batch_info);
+}
+
+static int pg_batch_retry(void* ctx, batch_id_t batch_id, int32_t retry_seconds) {
+  return batch_retry((PGconn*)ctx, batch_id, retry_seconds);
+}
+
+static int pg_event_retry(void* ctx, batch_id_t batch_id, event_id_t event_id, int32_t retry_seconds) {
+  return event_retry((PGconn*)ctx, batch_id, event_id, retry_seconds);
+}
+
+static int pg_finish_batch(void* ctx, batch_id_t batch_id) {
+  return finish_batch((PGconn*)ctx, batch_id);
+}
+
+static void pg_close(void* ctx) {
+}
+
+static const backend_ops_t PG_BACKEND_OPS = {
+  pg_create_queue,
+  pg_drop_queue,
+  pg_insert_event,
+  pg_tick,
+  pg_register_consumer,
+  pg_unregister_consumer,
+  pg_next_batch,
+  pg_get_batch_events,
+  pg_get_batch_info,
+  pg_batch_retry,
+  pg_event_retry,
+  pg_finish_batch,
+  pg_close
+};
+
+void pg_backend_init(backend_t* backend, PGconn* conn) {
+  backend->ops = &PG_BACKEND_OPS;
+  backend->ctx = conn;
+}
+
+void backend_close(backend_t* backend) {
+  if (backend->ops)
+    backend->ops->close(backend->ctx);
+  backend->ops = NULL;
+  backend->ctx = NULL;
+}
+
+int backend_create_queue(backend_t* backend, const char* queue_name) {
+  return backend->ops->create_queue(backend->ctx, queue_name);
+}
+
+int backend_drop_queue(backend_t* backend, const char* queue_name) {
+  return backend->ops->drop_queue(backend->ctx, queue_name, 0);
+}
+
+int backend_drop_queue_force(backend_t* backend, const char* queue_name) {
+  return backend->ops->drop_queue(backend->ctx, queue_name, 1);
+}
+
+event_id_t backend_insert_event(backend_t* backend, const char* queue_name, const char* ev_type, const char* ev_data) {
+  return backend->ops->insert_event(backend->ctx, queue_name, ev_type, ev_data, NULL, NULL, NULL, NULL);
+}
+
+event_id_t backend_insert_event_ex(backend_t* backend, const char* queue_name, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  return backend->ops->insert_event(backend->ctx, queue_name, ev_type, ev_data, extra1, extra2, extra3, extra4);
+}
+
+tick_id_t backend_tick(backend_t* backend, const char* queue_name) {
+  return backend->ops->tick(backend->ctx, queue_name);
+}
+
+int backend_register_consumer(backend_t* backend, const char* queue_name, const char* consumer_name) {
+  return backend->ops->register_consumer(backend->ctx, queue_name, consumer_name);
+}
+
+int backend_unregister_consumer(backend_t* backend, const char* queue_name, const char* consumer_name) {
+  return backend->ops->unregister_consumer(backend->ctx, queue_name, consumer_name);
+}
+
+batch_id_t backend_next_batch(backend_t* backend, const char* queue_name, const char* consumer_name) {
+  return backend->ops->next_batch(backend->ctx, queue_name, consumer_name);
+}
+
+int backend_get_batch_events(backend_t* backend, batch_id_t batch_id, event_t** events) {
+  return backend->ops->get_batch_events(backend->ctx, batch_id, events);
+}
+
+int backend_get_batch_info(backend_t* backend, batch_id_t batch_id, batch_info_t** batch_info) {
+  return backend->ops->get_batch_info(backend->ctx, batch_id, batch_info);
+}
+
+int backend_batch_retry(backend_t* backend, batch_id_t batch_id, int32_t retry_seconds) {
+  return backend->ops->batch_retry(backend->ctx, batch_id, retry_seconds);
+}
+
+int backend_event_retry(backend_t* backend, batch_id_t batch_id, event_id_t event_id, int32_t retry_seconds) {
+  return backend->ops->event_retry(backend->ctx, batch_id, event_id, retry_seconds);
+}
+
+int backend_finish_batch(backend_t* backend, batch_id_t batch_id) {
+  return backend->ops->finish_batch(backend->ctx, batch_id);
+}
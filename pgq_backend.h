@@ -0,0 +1,113 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_BACKEND_H_INCLUDED
+#define PGQ_BACKEND_H_INCLUDED
+
+#include "pgq.h"
+
+/*
+Transport backends.
+backend_t gives the same queue/consumer/batch API on top of different transports:
+  - PgQ, which forwards calls to functions of pgq.h
+  - in-process memory queue, for tests and producer/consumer in one process
+  - shared memory queue, for producer/consumer on one host
+Memory backends follow PgQ semantics: events become visible to consumers only after a tick,
+every batch covers events between two ticks, a batch is given again until it is finished,
+and retried events are inserted again with increased retry counter on the first tick after
+their retry time. Unlike PgQ, memory backends are ticked by explicit backend_tick() calls.
+Return values are the same as of corresponding functions of pgq.h.
+*/
+
+typedef struct {
+  int         (*create_queue)(void* ctx, const char* queue_name);
+  int         (*drop_queue)(void* ctx, const char* queue_name, int force);
+  event_id_t  (*insert_event)(void* ctx, const char* queue_name, const char* ev_type, const char* ev_data,
+      const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+  tick_id_t   (*tick)(void* ctx, const char* queue_name);
+  int         (*register_consumer)(void* ctx, const char* queue_name, const char* consumer_name);
+  int         (*unregister_consumer)(void* ctx, const char* queue_name, const char* consumer_name);
+  batch_id_t  (*next_batch)(void* ctx, const char* queue_name, const char* consumer_name);
+  int         (*get_batch_events)(void* ctx, batch_id_t batch_id, event_t** events);
+  int         (*get_batch_info)(void* ctx, batch_id_t batch_id, batch_info_t** batch_info);
+  int         (*batch_retry)(void* ctx, batch_id_t batch_id, int32_t retry_seconds);
+  int         (*event_retry)(void* ctx, batch_id_t batch_id, event_id_t event_id, int32_t retry_seconds);
+  int         (*finish_batch)(void* ctx, batch_id_t batch_id);
+  void        (*close)(void* ctx);
+} backend_ops_t;
+
+typedef struct {
+  const backend_ops_t*  ops;
+  void*                 ctx;
+} backend_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* PgQ backend over existing connection, backend_close() does not close the connection */
+extern void pg_backend_init(backend_t* backend, PGconn* conn);
+
+/*
+In-process memory backend which holds up to 'max_queues' queues of up to 'ring_size'
+unconsumed events each.
+Returns
+  0  - success
+  -2 - if sizes are incorrect
+  -3 - if memory allocation unsuccess
+*/
+extern int mem_backend_open(backend_t* backend, int max_queues, int ring_size);
+
+/*
+Shared memory backend. The first process creates segment 'name' with given sizes, others attach
+to it and take sizes from the segment. Segment exists until shm_backend_unlink() is called.
+Returns
+  1  - if segment has been created
+  0  - if attached to existing segment
+  -1 - if system call fails
+  -2 - if sizes are incorrect
+*/
+extern int shm_backend_open(backend_t* backend, const char* name, int max_queues, int ring_size);
+extern int shm_backend_unlink(const char* name);
+
+extern void backend_close(backend_t* backend);
+
+extern int backend_create_queue(backend_t* backend, const char* queue_name);
+extern int backend_drop_queue(backend_t* backend, const char* queue_name);
+extern int backend_drop_queue_force(backend_t* backend, const char* queue_name);
+extern event_id_t backend_insert_event(backend_t* backend, const char* queue_name, const char* ev_type, const char* ev_data);
+extern event_id_t backend_insert_event_ex(backend_t* backend, const char* queue_name, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+/* Cuts new tick, returns its id or -1 if fails */
+extern tick_id_t backend_tick(backend_t* backend, const char* queue_name);
+extern int backend_register_consumer(backend_t* backend, const char* queue_name, const char* consumer_name);
+extern int backend_unregister_consumer(backend_t* backend, const char* queue_name, const char* consumer_name);
+extern batch_id_t backend_next_batch(backend_t* backend, const char* queue_name, const char* consumer_name);
+extern int backend_get_batch_events(backend_t* backend, batch_id_t batch_id, event_t** events);
+extern int backend_get_batch_info(backend_t* backend, batch_id_t batch_id, batch_info_t** batch_info);
+extern int backend_batch_retry(backend_t* backend, batch_id_t batch_id, int32_t retry_seconds);
+extern int backend_event_retry(backend_t* backend, batch_id_t batch_id, event_id_t event_id, int32_t retry_seconds);
+extern int backend_finish_batch(backend_t* backend, batch_id_t batch_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
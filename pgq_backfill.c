@@ -0,0 +1,243 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pgq_backfill.h"
+#include "pgq_internal.h"
+
+static const char* INCORRECT_WORKERS_ERR = "Incorrect amount of workers %d";
+static const char* CONSUMER_NOT_FOUND_ERR = "Consumer %s is not registered on queue %s";
+static const char* QUEUE_NOT_FOUND_ERR = "Queue %s is not found";
+static const char* ACTIVE_BATCH_ERR = "Consumer %s has active batch %ld";
+static const char* HANDLER_STOPPED_ERR = "Handler stopped backfill at batch %ld";
+static const char* SEGMENT_INCOMPLETE_ERR = "Segment %ld..%ld has no batch after tick %ld";
+static const char* THREAD_CREATE_ERR = "Could not create thread for worker %d";
+
+/* Subconsumer name is consumer name + suffix, so it must fit into limit too */
+static const char* SUBCONSUMER_PREFIX_FORMAT = "%.200s.backfill.";
+static const char* SUBCONSUMER_NAME_FORMAT = "%.200s.backfill.%d";
+
+typedef struct {
+  PGconn*               conn;
+  const char*           queue_name;
+  char                  consumer_name[MAX_CONSUMER_NAME_LENGTH];
+  backfill_handler_t    handler;
+  void*                 arg;
+  backfill_segment_t    segment;
+  _Atomic int*          stop;         /* shared by workers, set when any of them fails */
+  int                   ret;
+  int                   error_number;
+  char                  error_text[256];
+} backfill_worker_t;
+
+static void save_worker_error(backfill_worker_t* worker) {
+  /* result of other segments is thrown away anyway, so they stop too */
+  atomic_store(worker->stop, 1);
+  worker->ret = -1;
+  save_error(&worker->error_number, worker->error_text, ARRAY_SIZE(worker->error_text));
+}
+
+static void* run_worker(void* arg) {
+  backfill_worker_t* worker = (backfill_worker_t*)arg;
+  batch_info_t* info;
+  event_t* events;
+  batch_id_t batch_id;
+  tick_id_t tick_id;
+  int nevents;
+
+  if (register_consumer_at(worker->conn, worker->queue_name, worker->consumer_name, worker->segment.first_tick) < 0) {
+    save_worker_error(worker);
+    return NULL;
+  }
+  /* every batch covers one tick, so the segment ends exactly on its last tick */
+  tick_id = worker->segment.first_tick;
+  do {
+    if (atomic_load(worker->stop))
+      break;
+    batch_id = next_batch(worker->conn, worker->queue_name, worker->consumer_name);
+    if (batch_id < 0) {
+      save_worker_error(worker);
+      break;
+    }
+    if (batch_id == 0) {
+      /* consumer must not be moved past ticks which were not processed */
+      set_error(0, SEGMENT_INCOMPLETE_ERR, worker->segment.first_tick, worker->segment.last_tick, tick_id);
+      save_worker_error(worker);
+      break;
+    }
+    if (get_batch_info(worker->conn, batch_id, &info) < 0) {
+      save_worker_error(worker);
+      break;
+    }
+    tick_id = info->tick_id;
+    free(info);
+    nevents = get_batch_events(worker->conn, batch_id, &events);
+    if (nevents < 0) {
+      save_worker_error(worker);
+      break;
+    }
+    if (worker->handler(worker->arg, worker->conn, events, nevents) < 0) {
+      free(events);
+      set_error(0, HANDLER_STOPPED_ERR, batch_id);
+      save_worker_error(worker);
+      break;
+    }
+    free(events);
+    if (finish_batch(worker->conn, batch_id) < 0) {
+      save_worker_error(worker);
+      break;
+    }
+    ++worker->segment.batches;
+    worker->segment.events += nevents;
+  } while (tick_id < worker->segment.last_tick);
+
+  unregister_consumer(worker->conn, worker->queue_name, worker->consumer_name);
+  return NULL;
+}
+
+/* Finds queue's last tick, returns -1 if fails */
+static tick_id_t get_last_tick(PGconn* conn, const char* queue_name) {
+  queue_info_t* queues;
+  tick_id_t last_tick = -1;
+  int n, i;
+  n = get_queues_info(conn, &queues);
+  if (n < 0)
+    return -1;
+  for (i = 0; i < n; ++i) {
+    if (strcmp(queues[i].name, queue_name) == 0)
+      last_tick = queues[i].last_tick_id;
+  }
+  free(queues);
+  if (last_tick < 0)
+    set_error(0, QUEUE_NOT_FOUND_ERR, queue_name);
+  return last_tick;
+}
+
+/* Unregisters subconsumers left by backfill which has not finished, returns -1 if fails */
+static int drop_subconsumers(PGconn* conn, const char* queue_name, const char* consumer_name) {
+  char prefix[MAX_CONSUMER_NAME_LENGTH];
+  consumer_info_t* consumers;
+  size_t len;
+  int n, i, ret = 0;
+
+  len = snprintf(prefix, ARRAY_SIZE(prefix), SUBCONSUMER_PREFIX_FORMAT, consumer_name);
+  n = get_consumers_info(conn, queue_name, &consumers);
+  if (n < 0)
+    return -1;
+  for (i = 0; i < n && ret == 0; ++i) {
+    if (strncmp(consumers[i].consumer_name, prefix, len) == 0 &&
+        unregister_consumer(conn, queue_name, consumers[i].consumer_name) < 0)
+      ret = -1;
+  }
+  free(consumers);
+  return ret;
+}
+
+int64_t backfill_consumer(PGconn** conns, int nworkers, const char* queue_name, const char* consumer_name,
+    backfill_handler_t handler, void* arg, backfill_segment_t* segments, int* nsegments) {
+  backfill_worker_t workers[MAX_BACKFILL_WORKERS];
+  pthread_t threads[MAX_BACKFILL_WORKERS];
+  int started[MAX_BACKFILL_WORKERS];
+  consumer_info_t* info;
+  tick_id_t* ticks;
+  tick_id_t first_tick, last_tick;
+  int64_t processed = 0;
+  _Atomic int stop = 0;
+  int nticks, i, failed = 0;
+
+  if (nworkers <= 0 || nworkers > MAX_BACKFILL_WORKERS) {
+    set_error(0, INCORRECT_WORKERS_ERR, nworkers);
+    return -2;
+  }
+  if (nsegments)
+    *nsegments = 0;
+  if (drop_subconsumers(conns[0], queue_name, consumer_name) < 0)
+    return -1;
+  i = get_consumer_info(conns[0], queue_name, consumer_name, &info);
+  if (i < 0)
+    return -1;
+  if (i == 0) {
+    free(info);
+    set_error(0, CONSUMER_NOT_FOUND_ERR, consumer_name, queue_name);
+    return -1;
+  }
+  first_tick = info->last_tick;
+  if (info->current_batch > 0) {
+    set_error(0, ACTIVE_BATCH_ERR, consumer_name, info->current_batch);
+    free(info);
+    return -2;
+  }
+  free(info);
+
+  last_tick = get_last_tick(conns[0], queue_name);
+  if (last_tick < 0)
+    return -1;
+  nticks = get_queue_ticks(conns[0], queue_name, first_tick, last_tick, &ticks);
+  if (nticks < 0)
+    return -1;
+  if (nticks < 2) {
+    free(ticks);
+    return 0;
+  }
+  /* every worker needs at least one tick after its first one */
+  if (nworkers > nticks - 1)
+    nworkers = nticks - 1;
+
+  for (i = 0; i < nworkers; ++i) {
+    memset(&workers[i], 0, sizeof(backfill_worker_t));
+    workers[i].conn = conns[i];
+    workers[i].queue_name = queue_name;
+    snprintf(workers[i].consumer_name, ARRAY_SIZE(workers[i].consumer_name), SUBCONSUMER_NAME_FORMAT, consumer_name, i);
+    workers[i].handler = handler;
+    workers[i].arg = arg;
+    workers[i].stop = &stop;
+    workers[i].segment.first_tick = ticks[(int64_t)(nticks - 1) * i / nworkers];
+    workers[i].segment.last_tick = ticks[(int64_t)(nticks - 1) * (i + 1) / nworkers];
+  }
+  free(ticks);
+  if (nsegments)
+    *nsegments = nworkers;
+
+  for (i = 0; i < nworkers; ++i) {
+    started[i] = pthread_create(&threads[i], NULL, run_worker, &workers[i]) == 0;
+    if (!started[i]) {
+      set_error(0, THREAD_CREATE_ERR, i);
+      save_worker_error(&workers[i]);
+    }
+  }
+  for (i = 0; i < nworkers; ++i) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    if (workers[i].ret < 0 && failed++ == 0)
+      set_error(workers[i].error_number, "%s", workers[i].error_text);
+    if (segments)
+      segments[i] = workers[i].segment;
+    processed += workers[i].segment.events;
+  }
+  if (failed)
+    return -1;
+  if (register_consumer_at(conns[0], queue_name, consumer_name, last_tick) < 0)
+    return -1;
+  return processed;
+}
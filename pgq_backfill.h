@@ -0,0 +1,77 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_BACKFILL_H_INCLUDED
+#define PGQ_BACKFILL_H_INCLUDED
+
+#include "pgq.h"
+
+/*
+Parallel backfill of a consumer.
+Ticks between consumer's position and queue's last tick are split into segments, one per worker.
+Every worker reads its segment batch by batch with a temporary subconsumer attached at segment's
+first tick, on its own connection and in its own thread. When all segments are processed the
+consumer is moved to the last tick, after that it continues with next_batch() as usual.
+Order of events is kept inside a segment only. The consumer itself must not process batches
+while backfill is running.
+Subconsumers are named '<consumer>.backfill.<N>'. They are unregistered when workers finish,
+and ones left by a crashed process are unregistered when the next backfill of the consumer starts.
+*/
+
+#define MAX_BACKFILL_WORKERS      64
+
+/*
+Called for every batch from worker's thread, several handlers are running concurrently.
+Events can not be retried: batches belong to temporary subconsumers which are dropped together
+with their retry queues. Handler returns negative value to stop backfill instead, the consumer
+is not moved then and backfill may be started again.
+*/
+typedef int (*backfill_handler_t)(void* arg, PGconn* conn, event_t* events, int nevents);
+
+typedef struct {
+  tick_id_t   first_tick;   /* subconsumer starts here, events of this tick are not included */
+  tick_id_t   last_tick;
+  int64_t     batches;
+  int64_t     events;
+} backfill_segment_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Backfills the consumer using up to 'nworkers' connections, one worker per connection. Less workers
+are used if there are less ticks to process than workers.
+If 'segments' is not NULL it receives progress of every used worker and must have room for 'nworkers'
+items, amount of used workers is stored into 'nsegments' if it is not NULL.
+When a worker fails or its handler stops backfill, other workers stop before their next batch.
+Returns
+  N  - amount of processed events
+  -1 - if DB operation fails or handler stops backfill, the consumer is not moved then
+  -2 - if amount of workers is incorrect or consumer has active batch
+*/
+extern int64_t backfill_consumer(PGconn** conns, int nworkers, const char* queue_name, const char* consumer_name,
+    backfill_handler_t handler, void* arg, backfill_segment_t* segments, int* nsegments);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pgq_coalesce.h"
+#include "pgq_internal.h"
+
+static const char* INCORRECT_PARAMS_ERR = "Incorrect key field %d, window %d ms or capacity %d";
+
+#define EMPTY_SLOT (-1)
+
+static const char* event_key(const coalescer_t* coalescer, const event_t* event) {
+  switch (coalescer->key_field) {
+    case 1: return event->extra1;
+    case 2: return event->extra2;
+    case 3: return event->extra3;
+    default: return event->extra4;
+  }
+}
+
+static uint32_t hash_key(const char* type, const char* key) {
+  return fnv_hash(fnv_hash(FNV_OFFSET_BASIS, type), key);
+}
+
+int coalescer_init(coalescer_t* coalescer, PGconn* conn, const char* queue_name, int key_field,
+    int window_ms, int capacity, coalesce_merge_t merge, void* merge_arg) {
+  size_t size;
+
+  memset(coalescer, 0, sizeof(*coalescer));
+  if (key_field < 1 || key_field > 4 || window_ms < 0 || capacity <= 0) {
+    set_error(0, INCORRECT_PARAMS_ERR, key_field, window_ms, capacity);
+    return -2;
+  }
+  coalescer->conn = conn;
+  copy_field(coalescer->queue_name, queue_name, ARRAY_SIZE(coalescer->queue_name));
+  coalescer->key_field = key_field;
+  coalescer->window_usec = (int64_t)window_ms * 1000;
+  coalescer->capacity = capacity;
+  coalescer->merge = merge;
+  coalescer->merge_arg = merge_arg;
+  /* hash table is kept at most half full */
+  for (coalescer->nslots = 2; coalescer->nslots < 2 * capacity; coalescer->nslots *= 2)
+    ;
+
+  size = capacity * sizeof(event_t);
+  coalescer->events = (event_t*)malloc(size);
+  if (coalescer->events) {
+    size = coalescer->nslots * sizeof(int);
+    coalescer->slots = (int*)malloc(size);
+  }
+  if (!coalescer->events || !coalescer->slots) {
+    set_error(0, MEMORY_ALLOC_ERR, (int)size);
+    coalescer_free(coalescer);
+    return -3;
+  }
+  memset(coalescer->slots, EMPTY_SLOT, coalescer->nslots * sizeof(int));
+  return 0;
+}
+
+void coalescer_free(coalescer_t* coalescer) {
+  free(coalescer->events);
+  free(coalescer->slots);
+  coalescer->events = NULL;
+  coalescer->slots = NULL;
+  coalescer->nevents = 0;
+}
+
+/* Returns slot of the key: either holding buffered event with the same type and key or empty one */
+static int find_slot(const coalescer_t* coalescer, const char* type, const char* key) {
+  int mask = coalescer->nslots - 1;
+  int slot = (int)(hash_key(type, key) & mask);
+  const event_t* event;
+  while (coalescer->slots[slot] != EMPTY_SLOT) {
+    event = &coalescer->events[coalescer->slots[slot]];
+    if (strcmp(event->type, type) == 0 && strcmp(event_key(coalescer, event), key) == 0)
+      break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+int coalescer_insert_event(coalescer_t* coalescer, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  event_t incoming;
+  event_t* pending;
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  const char* extras[4];
+  const char* key;
+  int slot = EMPTY_SLOT, keyed, ret;
+
+  if (coalescer->nevents > 0 && monotonic_usec() - coalescer->window_start >= coalescer->window_usec) {
+    ret = coalescer_flush(coalescer);
+    if (ret < 0)
+      return ret;
+  }
+
+  /* produce time is taken here, not when the window is written */
+  extras[0] = extra1;
+  extras[1] = extra2;
+  extras[2] = extra3;
+  extras[3] = extra4;
+  /* latency stamp may go into empty key field, such event must still not be coalesced */
+  keyed = extras[coalescer->key_field - 1] && *extras[coalescer->key_field - 1];
+  stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+
+  copy_field(incoming.type, ev_type, ARRAY_SIZE(incoming.type));
+  copy_field(incoming.data, ev_data, ARRAY_SIZE(incoming.data));
+  copy_field(incoming.extra1, extras[0], ARRAY_SIZE(incoming.extra1));
+  copy_field(incoming.extra2, extras[1], ARRAY_SIZE(incoming.extra2));
+  copy_field(incoming.extra3, extras[2], ARRAY_SIZE(incoming.extra3));
+  copy_field(incoming.extra4, extras[3], ARRAY_SIZE(incoming.extra4));
+  key = event_key(coalescer, &incoming);
+
+  if (keyed) {
+    slot = find_slot(coalescer, incoming.type, key);
+    if (coalescer->slots[slot] != EMPTY_SLOT) {
+      pending = &coalescer->events[coalescer->slots[slot]];
+      if (coalescer->merge)
+        coalescer->merge(coalescer->merge_arg, pending, &incoming);
+      else
+        memcpy(pending, &incoming, sizeof(event_t));
+      ++coalescer->coalesced;
+      return 0;
+    }
+  }
+
+  if (coalescer->nevents == coalescer->capacity) {
+    ret = coalescer_flush(coalescer);
+    if (ret < 0)
+      return ret;
+    if (keyed)
+      slot = find_slot(coalescer, incoming.type, key);
+  }
+  if (coalescer->nevents == 0)
+    coalescer->window_start = monotonic_usec();
+  if (keyed)
+    coalescer->slots[slot] = coalescer->nevents;
+  memcpy(&coalescer->events[coalescer->nevents++], &incoming, sizeof(event_t));
+  return 1;
+}
+
+int coalescer_poll(coalescer_t* coalescer) {
+  if (coalescer->nevents == 0 || monotonic_usec() - coalescer->window_start < coalescer->window_usec)
+    return 0;
+  return coalescer_flush(coalescer);
+}
+
+int coalescer_flush(coalescer_t* coalescer) {
+  int ret;
+  if (coalescer->nevents == 0)
+    return 0;
+  ret = insert_events(coalescer->conn, coalescer->queue_name, coalescer->events, coalescer->nevents, NULL);
+  if (ret < 0)
+    return ret;
+  coalescer->nevents = 0;
+  memset(coalescer->slots, EMPTY_SLOT, coalescer->nslots * sizeof(int));
+  return ret;
+}
@@ -0,0 +1,108 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_COALESCE_H_INCLUDED
+#define PGQ_COALESCE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "pgq.h"
+
+/*
+Producer side coalescing of events.
+Events are collected in a buffer for a time window. An event with the same type and key
+(one of extra fields) as a buffered event replaces it or is merged into it by user function,
+so only the latest state of every key is written. The buffer is written by insert_events()
+in one statement when the window expires or the buffer is full.
+Buffered events keep position of the first event of their key. Events with empty key are
+never coalesced. Coalescer is not thread safe.
+*/
+
+/*
+Merges 'incoming' event into buffered 'pending' event which has the same type and key.
+Without merge function 'pending' is replaced by 'incoming'.
+*/
+typedef void (*coalesce_merge_t)(void* arg, event_t* pending, const event_t* incoming);
+
+typedef struct {
+  PGconn*           conn;
+  char              queue_name[MAX_QUEUE_NAME_LENGTH];
+  int               key_field;
+  int64_t           window_usec;
+  int               capacity;
+  coalesce_merge_t  merge;
+  void*             merge_arg;
+  event_t*          events;
+  int               nevents;
+  int*              slots;
+  int               nslots;
+  int64_t           window_start;
+  int64_t           coalesced;      /* amount of events absorbed by buffered ones */
+} coalescer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Initializes coalescer. 'key_field' is number of extra field (1-4) used as key, events are
+buffered up to 'window_ms' milliseconds and up to 'capacity' distinct keys. 'merge' may be NULL.
+Returns
+  0  - success
+  -2 - if parameters are incorrect
+  -3 - if memory allocation unsuccess
+*/
+extern int coalescer_init(coalescer_t* coalescer, PGconn* conn, const char* queue_name, int key_field,
+    int window_ms, int capacity, coalesce_merge_t merge, void* merge_arg);
+
+/* Releases coalescer's memory. Buffered events are lost, call coalescer_flush() before. */
+extern void coalescer_free(coalescer_t* coalescer);
+
+/*
+Buffers new event, flushes the buffer first when the window has expired or the buffer is full.
+Returns
+  1  - if event is buffered as new one
+  0  - if event is coalesced with buffered one
+  <0 - if flush fails (see coalescer_flush()), the event is not buffered then
+*/
+extern int coalescer_insert_event(coalescer_t* coalescer, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+
+/*
+Flushes the buffer if the window has expired. Should be called periodically when there are no new events.
+Returns
+  N  - amount of written events
+  <0 - if flush fails
+*/
+extern int coalescer_poll(coalescer_t* coalescer);
+
+/*
+Writes buffered events. Events are kept buffered if write fails.
+Returns
+  N  - amount of written events
+  <0 - if fails, see insert_events()
+*/
+extern int coalescer_flush(coalescer_t* coalescer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
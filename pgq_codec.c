@@ -0,0 +1,281 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "pgq_codec.h"
+#include "pgq_internal.h"
+
+static const char* FIELD_TYPE_ERR = "Field %s of codec %s has unsupported type or size %d";
+static const char* PAYLOAD_TOO_BIG_ERR = "Payload of codec %s does not fit into %d bytes";
+static const char* PAYLOAD_MALFORMED_ERR = "Payload of event type %s is malformed";
+static const char* EVENT_TYPE_MISMATCH_ERR = "Event type %s does not match codec %s";
+
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Size of payload header: version and amount of fields */
+#define PAYLOAD_HEADER_SIZE 2
+
+static void put_number(uint8_t* dst, const uint8_t* src, size_t size) {
+  uint64_t value = 0;
+  size_t i;
+  switch (size) {
+    case 1: value = *src; break;
+    case 2: { uint16_t v; memcpy(&v, src, 2); value = v; } break;
+    case 4: { uint32_t v; memcpy(&v, src, 4); value = v; } break;
+    case 8: memcpy(&value, src, 8); break;
+  }
+  for (i = 0; i < size; ++i) {
+    dst[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static void get_number(uint8_t* dst, const uint8_t* src, size_t size) {
+  uint64_t value = 0;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    value |= (uint64_t)src[i] << (8 * i);
+  }
+  switch (size) {
+    case 1: *dst = (uint8_t)value; break;
+    case 2: { uint16_t v = (uint16_t)value; memcpy(dst, &v, 2); } break;
+    case 4: { uint32_t v = (uint32_t)value; memcpy(dst, &v, 4); } break;
+    case 8: memcpy(dst, &value, 8); break;
+  }
+}
+
+static int check_field(const codec_t* codec, const field_t* field) {
+  switch (field->type) {
+    case FIELD_NUMBER:
+      if (field->size == 1 || field->size == 2 || field->size == 4 || field->size == 8)
+        return 0;
+      break;
+    case FIELD_STRING:
+      if (field->size > 0 && field->size <= UINT16_MAX)
+        return 0;
+      break;
+    case FIELD_BYTES:
+      if (field->size <= MAX_CODEC_PAYLOAD_SIZE)
+        return 0;
+      break;
+  }
+  set_error(0, FIELD_TYPE_ERR, field->name, codec->ev_type, (int)field->size);
+  return -2;
+}
+
+static size_t base64_encode(const uint8_t* src, size_t len, char* dst) {
+  size_t i, n = 0;
+  uint32_t triple;
+  for (i = 0; i + 2 < len; i += 3) {
+    triple = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+    dst[n++] = BASE64_ALPHABET[(triple >> 18) & 0x3F];
+    dst[n++] = BASE64_ALPHABET[(triple >> 12) & 0x3F];
+    dst[n++] = BASE64_ALPHABET[(triple >> 6) & 0x3F];
+    dst[n++] = BASE64_ALPHABET[triple & 0x3F];
+  }
+  if (i < len) {
+    triple = (uint32_t)src[i] << 16;
+    if (i + 1 < len)
+      triple |= (uint32_t)src[i + 1] << 8;
+    dst[n++] = BASE64_ALPHABET[(triple >> 18) & 0x3F];
+    dst[n++] = BASE64_ALPHABET[(triple >> 12) & 0x3F];
+    dst[n++] = (i + 1 < len) ? BASE64_ALPHABET[(triple >> 6) & 0x3F] : '=';
+    dst[n++] = '=';
+  }
+  dst[n] = '\0';
+  return n;
+}
+
+static int base64_value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+/* Returns amount of decoded bytes or -1 if text is not valid base64 */
+static int base64_decode(const char* src, uint8_t* dst, size_t size) {
+  size_t len = strlen(src), i, n = 0;
+  int v[4], k;
+  if (len % 4 != 0 || len / 4 * 3 > size)
+    return -1;
+  for (i = 0; i < len; i += 4) {
+    for (k = 0; k < 4; ++k) {
+      v[k] = base64_value(src[i + k]);
+    }
+    /* padding is allowed only at the end of text */
+    if (v[0] < 0 || v[1] < 0 || (v[2] < 0 && v[3] >= 0))
+      return -1;
+    if ((v[2] < 0 || v[3] < 0) && (i + 4 != len || src[i + 3] != '=' || (v[2] < 0 && src[i + 2] != '=')))
+      return -1;
+    dst[n++] = (uint8_t)((v[0] << 2) | (v[1] >> 4));
+    if (v[2] >= 0)
+      dst[n++] = (uint8_t)((v[1] << 4) | (v[2] >> 2));
+    if (v[3] >= 0)
+      dst[n++] = (uint8_t)((v[2] << 6) | v[3]);
+  }
+  return (int)n;
+}
+
+int encode_event_data(const codec_t* codec, const void* obj, char* ev_data, size_t size) {
+  uint8_t payload[MAX_CODEC_PAYLOAD_SIZE];
+  const uint8_t* src = (const uint8_t*)obj;
+  const field_t* field;
+  size_t len = PAYLOAD_HEADER_SIZE, n = 0;
+  int i;
+
+  if (codec->nfields > UINT8_MAX) {
+    set_error(0, FIELD_TYPE_ERR, "count", codec->ev_type, codec->nfields);
+    return -2;
+  }
+  payload[0] = codec->version;
+  payload[1] = (uint8_t)codec->nfields;
+  for (i = 0; i < codec->nfields; ++i) {
+    field = &codec->fields[i];
+    if (check_field(codec, field) != 0)
+      return -2;
+    switch (field->type) {
+      case FIELD_NUMBER:
+      case FIELD_BYTES:
+        n = field->size;
+        break;
+      case FIELD_STRING:
+        /* decoder needs room for terminating zero, so array filled up to the end is cut */
+        n = strnlen((const char*)src + field->offset, field->size - 1);
+        break;
+    }
+    if (len + n + (field->type == FIELD_STRING ? 2 : 0) > ARRAY_SIZE(payload))
+      goto too_big;
+    switch (field->type) {
+      case FIELD_NUMBER:
+        put_number(payload + len, src + field->offset, n);
+        break;
+      case FIELD_STRING:
+        payload[len++] = (uint8_t)n;
+        payload[len++] = (uint8_t)(n >> 8);
+        /* fall through */
+      case FIELD_BYTES:
+        memcpy(payload + len, src + field->offset, n);
+        break;
+    }
+    len += n;
+  }
+  if ((len + 2) / 3 * 4 + 1 > size)
+    goto too_big;
+  return (int)base64_encode(payload, len, ev_data);
+
+too_big:
+  set_error(0, PAYLOAD_TOO_BIG_ERR, codec->ev_type, (int)size);
+  return -1;
+}
+
+int decode_event_data(const codec_t* codec, const char* ev_data, void* obj) {
+  uint8_t payload[MAX_CODEC_PAYLOAD_SIZE];
+  uint8_t* dst = (uint8_t*)obj;
+  const field_t* field;
+  int len, pos = PAYLOAD_HEADER_SIZE, i, nfields;
+  size_t n;
+
+  len = base64_decode(ev_data, payload, ARRAY_SIZE(payload));
+  if (len < PAYLOAD_HEADER_SIZE)
+    goto malformed;
+  nfields = payload[1] < codec->nfields ? payload[1] : codec->nfields;
+  for (i = 0; i < nfields; ++i) {
+    field = &codec->fields[i];
+    if (check_field(codec, field) != 0)
+      return -2;
+    n = field->size;
+    if (field->type == FIELD_STRING) {
+      if (pos + 2 > len)
+        goto malformed;
+      n = payload[pos] | ((size_t)payload[pos + 1] << 8);
+      pos += 2;
+      if (n >= field->size)
+        goto malformed;
+    }
+    if (pos + (int)n > len)
+      goto malformed;
+    switch (field->type) {
+      case FIELD_NUMBER:
+        get_number(dst + field->offset, payload + pos, n);
+        break;
+      case FIELD_STRING:
+        dst[field->offset + n] = '\0';
+        /* fall through */
+      case FIELD_BYTES:
+        memcpy(dst + field->offset, payload + pos, n);
+        break;
+    }
+    pos += (int)n;
+  }
+  return payload[0];
+
+malformed:
+  set_error(0, PAYLOAD_MALFORMED_ERR, codec->ev_type);
+  return -1;
+}
+
+int decode_event(const codec_t* codec, const event_t* event, void* obj) {
+  if (strcmp(event->type, codec->ev_type) != 0) {
+    set_error(0, EVENT_TYPE_MISMATCH_ERR, event->type, codec->ev_type);
+    return -3;
+  }
+  return decode_event_data(codec, event->data, obj);
+}
+
+const codec_t* find_codec(const codec_t* codecs, int ncodecs, const char* ev_type) {
+  int i;
+  for (i = 0; i < ncodecs; ++i) {
+    if (strcmp(codecs[i].ev_type, ev_type) == 0)
+      return &codecs[i];
+  }
+  return NULL;
+}
+
+/* Encodes payload into 'ev_data' limited by what the insert query can carry, returns -2/-3 if fails */
+static int encode_for_insert(const codec_t* codec, const void* obj, char* ev_data, size_t size, const char* queue_name,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  size_t room = insert_event_data_room(queue_name, codec->ev_type, extra1, extra2, extra3, extra4) + 1;
+  int ret = encode_event_data(codec, obj, ev_data, room < size ? room : size);
+  if (ret == -1)
+    return -2;
+  if (ret == -2)
+    return -3;
+  return 0;
+}
+
+event_id_t insert_typed_event(PGconn* conn, const char* queue_name, const codec_t* codec, const void* obj) {
+  char ev_data[MAX_EVENT_DATA_LENGTH];
+  int ret = encode_for_insert(codec, obj, ev_data, ARRAY_SIZE(ev_data), queue_name, NULL, NULL, NULL, NULL);
+  if (ret < 0)
+    return ret;
+  return insert_event(conn, queue_name, codec->ev_type, ev_data);
+}
+
+event_id_t insert_typed_event_ex(PGconn* conn, const char* queue_name, const codec_t* codec, const void* obj,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  char ev_data[MAX_EVENT_DATA_LENGTH];
+  int ret = encode_for_insert(codec, obj, ev_data, ARRAY_SIZE(ev_data), queue_name, extra1, extra2, extra3, extra4);
+  if (ret < 0)
+    return ret;
+  return insert_event_ex(conn, queue_name, codec->ev_type, ev_data, extra1, extra2, extra3, extra4);
+}
@@ -0,0 +1,130 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_CODEC_H_INCLUDED
+#define PGQ_CODEC_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pgq.h"
+
+/*
+Typed event payloads.
+Layout of a structure is described once by a static table of field descriptors which is built at
+compile time (offsetof/sizeof), e.g.
+
+  typedef struct { int32_t id; double price; char name[32]; } order_t;
+
+  static const field_t ORDER_FIELDS[] = {
+    CODEC_FIELD(order_t, id,    FIELD_NUMBER),
+    CODEC_FIELD(order_t, price, FIELD_NUMBER),
+    CODEC_FIELD(order_t, name,  FIELD_STRING)
+  };
+  static const codec_t ORDER_CODEC = CODEC("order", 1, ORDER_FIELDS);
+
+Structure is packed into compact binary form (numbers as little-endian fixed width values,
+strings as length + bytes) and stored into ev_data as base64 text, ev_type is taken from codec.
+Versioning: a new version of a codec may only append fields to the end of the table. Payload
+carries its version and amount of fields, so older consumers skip trailing fields they do not
+know and newer consumers leave fields missing in older payloads untouched.
+*/
+
+#define MAX_CODEC_PAYLOAD_SIZE    ((MAX_EVENT_DATA_LENGTH - 1) / 4 * 3)
+
+typedef enum {
+  FIELD_NUMBER,   /* integer or floating point member of 1, 2, 4 or 8 bytes */
+  FIELD_STRING,   /* zero terminated char array */
+  FIELD_BYTES     /* raw memory copied as is */
+} field_type_t;
+
+typedef struct {
+  const char*   name;
+  field_type_t  type;
+  size_t        offset;
+  size_t        size;
+} field_t;
+
+typedef struct {
+  const char*     ev_type;
+  uint8_t         version;
+  const field_t*  fields;
+  int             nfields;
+} codec_t;
+
+#define CODEC_FIELD(struct_type, member, field_type) \
+  { #member, field_type, offsetof(struct_type, member), sizeof(((struct_type*)0)->member) }
+
+#define CODEC(ev_type, version, fields) \
+  { ev_type, version, fields, (int)(sizeof(fields)/sizeof(fields[0])) }
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Encodes structure 'obj' into 'ev_data' buffer of 'size' bytes (including terminating zero).
+Returns
+  N  - length of encoded text
+  -1 - if buffer is too small
+  -2 - if codec describes unsupported field
+*/
+extern int encode_event_data(const codec_t* codec, const void* obj, char* ev_data, size_t size);
+
+/*
+Decodes 'ev_data' into structure 'obj'. Fields which are absent in payload are left untouched.
+Returns
+  N  - version of decoded payload
+  -1 - if payload is malformed
+  -2 - if codec describes unsupported field
+*/
+extern int decode_event_data(const codec_t* codec, const char* ev_data, void* obj);
+
+/*
+Same as decode_event_data() but also checks that event has been produced with this codec.
+Returns
+  N  - version of decoded payload
+  -1 - if payload is malformed
+  -2 - if codec describes unsupported field
+  -3 - if event type does not match codec
+*/
+extern int decode_event(const codec_t* codec, const event_t* event, void* obj);
+
+/* Returns codec for event type from 'codecs' array or NULL if there is no such one */
+extern const codec_t* find_codec(const codec_t* codecs, int ncodecs, const char* ev_type);
+
+/*
+Encodes structure and generates new event with codec's type. Payload is limited by the query which
+carries it, besides MAX_CODEC_PAYLOAD_SIZE, so long queue name, type and extras leave less room.
+Returns
+  N  - id of new event
+  -1 - if DB operation fails
+  -2 - if payload is too big for the query
+  -3 - if codec describes unsupported field
+*/
+extern event_id_t insert_typed_event(PGconn* conn, const char* queue_name, const codec_t* codec, const void* obj);
+extern event_id_t insert_typed_event_ex(PGconn* conn, const char* queue_name, const codec_t* codec, const void* obj,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pgq_group.h"
+#include "pgq_internal.h"
+
+static const char* INCORRECT_PARAMS_ERR = "Incorrect group size %d or delay %ld";
+static const char* THREAD_CREATE_ERR = "Could not create group commit thread";
+static const char* STOPPED_ERR = "Group commit of queue %s is stopped";
+
+/* Takes up to 'max_events' oldest requests, writes them and wakes up their threads */
+static void write_group(group_commit_t* group) {
+  group_request_t* first = group->head;
+  group_request_t* request;
+  int n = 0, ret, i;
+
+  for (request = first; request && n < group->max_events; request = request->next) {
+    memcpy(&group->events[n++], &request->event, sizeof(event_t));
+  }
+  group->head = request;
+  if (!group->head)
+    group->tail = NULL;
+  group->npending -= n;
+  pthread_mutex_unlock(&group->lock);
+
+  ret = insert_events(group->conn, group->queue_name, group->events, n, group->event_ids);
+
+  pthread_mutex_lock(&group->lock);
+  for (request = first, i = 0; i < n; request = request->next, ++i) {
+    if (ret < 0) {
+      request->event_id = -1;
+      save_error(&request->error_number, request->error_text, ARRAY_SIZE(request->error_text));
+    } else {
+      request->event_id = group->event_ids[i];
+    }
+    request->done = 1;
+  }
+  if (ret >= 0) {
+    ++group->commits;
+    group->committed += n;
+  }
+  pthread_cond_broadcast(&group->done_cond);
+}
+
+static void* run_group_commit(void* arg) {
+  group_commit_t* group = (group_commit_t*)arg;
+  struct timespec deadline;
+  int64_t deadline_usec;
+
+  pthread_mutex_lock(&group->lock);
+  while (1) {
+    while (!group->stop && group->npending == 0)
+      pthread_cond_wait(&group->pending_cond, &group->lock);
+    if (group->npending == 0)
+      break;
+    /* wait for more events until the group is full or its oldest event is late */
+    while (!group->stop && group->npending < group->max_events) {
+      deadline_usec = group->head->submit_usec + group->max_delay_usec;
+      if (monotonic_usec() >= deadline_usec)
+        break;
+      deadline.tv_sec = deadline_usec / 1000000;
+      deadline.tv_nsec = (deadline_usec % 1000000) * 1000;
+      pthread_cond_timedwait(&group->pending_cond, &group->lock, &deadline);
+    }
+    write_group(group);
+  }
+  pthread_mutex_unlock(&group->lock);
+  return NULL;
+}
+
+int group_commit_start(group_commit_t* group, PGconn* conn, const char* queue_name, int max_events,
+    int64_t max_delay_usec) {
+  pthread_condattr_t attr;
+  size_t size;
+
+  memset(group, 0, sizeof(*group));
+  if (max_events <= 0 || max_delay_usec < 0) {
+    set_error(0, INCORRECT_PARAMS_ERR, max_events, (long)max_delay_usec);
+    return -2;
+  }
+  group->conn = conn;
+  copy_field(group->queue_name, queue_name, ARRAY_SIZE(group->queue_name));
+  group->max_events = max_events;
+  group->max_delay_usec = max_delay_usec;
+
+  size = max_events * sizeof(event_t);
+  group->events = (event_t*)malloc(size);
+  if (group->events) {
+    size = max_events * sizeof(event_id_t);
+    group->event_ids = (event_id_t*)malloc(size);
+  }
+  if (!group->events || !group->event_ids) {
+    set_error(0, MEMORY_ALLOC_ERR, (int)size);
+    free(group->events);
+    free(group->event_ids);
+    return -3;
+  }
+
+  pthread_mutex_init(&group->lock, NULL);
+  /* deadlines are computed with monotonic clock */
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&group->pending_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&group->done_cond, NULL);
+
+  if (pthread_create(&group->thread, NULL, run_group_commit, group) != 0) {
+    set_error(0, THREAD_CREATE_ERR);
+    pthread_cond_destroy(&group->done_cond);
+    pthread_cond_destroy(&group->pending_cond);
+    pthread_mutex_destroy(&group->lock);
+    free(group->events);
+    free(group->event_ids);
+    return -1;
+  }
+  return 0;
+}
+
+void group_commit_stop(group_commit_t* group) {
+  pthread_mutex_lock(&group->lock);
+  group->stop = 1;
+  pthread_cond_signal(&group->pending_cond);
+  pthread_mutex_unlock(&group->lock);
+  pthread_join(group->thread, NULL);
+
+  /* callers of submitted requests still need the lock to return from group_commit_wait() */
+  pthread_mutex_lock(&group->lock);
+  while (group->ninflight > 0)
+    pthread_cond_wait(&group->done_cond, &group->lock);
+  pthread_mutex_unlock(&group->lock);
+
+  pthread_cond_destroy(&group->done_cond);
+  pthread_cond_destroy(&group->pending_cond);
+  pthread_mutex_destroy(&group->lock);
+  free(group->events);
+  free(group->event_ids);
+  group->events = NULL;
+  group->event_ids = NULL;
+}
+
+int group_commit_submit(group_commit_t* group, group_request_t* request, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  const char* extras[4];
+
+  /* produce time is taken here, not when the group is written */
+  extras[0] = extra1;
+  extras[1] = extra2;
+  extras[2] = extra3;
+  extras[3] = extra4;
+  stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+
+  copy_field(request->event.type, ev_type, ARRAY_SIZE(request->event.type));
+  copy_field(request->event.data, ev_data, ARRAY_SIZE(request->event.data));
+  copy_field(request->event.extra1, extras[0], ARRAY_SIZE(request->event.extra1));
+  copy_field(request->event.extra2, extras[1], ARRAY_SIZE(request->event.extra2));
+  copy_field(request->event.extra3, extras[2], ARRAY_SIZE(request->event.extra3));
+  copy_field(request->event.extra4, extras[3], ARRAY_SIZE(request->event.extra4));
+  request->event_id = -1;
+  request->done = 0;
+  request->next = NULL;
+
+  pthread_mutex_lock(&group->lock);
+  if (group->stop) {
+    pthread_mutex_unlock(&group->lock);
+    set_error(0, STOPPED_ERR, group->queue_name);
+    return -1;
+  }
+  request->submit_usec = monotonic_usec();
+  if (group->tail)
+    group->tail->next = request;
+  else
+    group->head = request;
+  group->tail = request;
+  /* counted under the same lock hold, so stop never misses a caller between submit and wait */
+  ++group->ninflight;
+  /* flusher needs to know about the first event to start its timer, and about full group */
+  if (++group->npending == 1 || group->npending == group->max_events)
+    pthread_cond_signal(&group->pending_cond);
+  pthread_mutex_unlock(&group->lock);
+  return 0;
+}
+
+event_id_t group_commit_wait(group_commit_t* group, group_request_t* request) {
+  pthread_mutex_lock(&group->lock);
+  while (!request->done)
+    pthread_cond_wait(&group->done_cond, &group->lock);
+  if (--group->ninflight == 0 && group->stop)
+    pthread_cond_broadcast(&group->done_cond);
+  pthread_mutex_unlock(&group->lock);
+  if (request->event_id < 0)
+    set_error(request->error_number, "%s", request->error_text);
+  return request->event_id;
+}
+
+event_id_t group_commit_insert_event(group_commit_t* group, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  group_request_t request;
+  if (group_commit_submit(group, &request, ev_type, ev_data, extra1, extra2, extra3, extra4) < 0)
+    return -1;
+  return group_commit_wait(group, &request);
+}
@@ -0,0 +1,112 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_GROUP_H_INCLUDED
+#define PGQ_GROUP_H_INCLUDED
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "pgq.h"
+
+/*
+Group commit of events produced by many threads.
+Threads submit single events, a background thread collects them and writes every group by
+insert_events() in one statement, i.e. in one transaction and one WAL flush. A group is written
+when 'max_events' events are collected or the oldest of them has waited 'max_delay_usec'.
+group_commit_insert_event() blocks until the group is committed, group_commit_submit() and
+group_commit_wait() allow to do something else meanwhile. The connection must not be used by
+other code while group commit is running.
+*/
+
+typedef struct group_request_s {
+  event_t                   event;
+  int64_t                   submit_usec;
+  event_id_t                event_id;
+  int                       done;
+  int                       error_number;
+  char                      error_text[256];
+  struct group_request_s*   next;
+} group_request_t;
+
+typedef struct {
+  PGconn*           conn;
+  char              queue_name[MAX_QUEUE_NAME_LENGTH];
+  int               max_events;
+  int64_t           max_delay_usec;
+  pthread_mutex_t   lock;
+  pthread_cond_t    pending_cond;
+  pthread_cond_t    done_cond;
+  group_request_t*  head;
+  group_request_t*  tail;
+  int               npending;
+  int               ninflight;      /* submitted requests which have not returned from group_commit_wait() */
+  int               stop;
+  pthread_t         thread;
+  event_t*          events;
+  event_id_t*       event_ids;
+  int64_t           commits;        /* amount of written groups */
+  int64_t           committed;      /* amount of written events */
+} group_commit_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Starts background thread which writes events into the queue over 'conn'.
+Returns
+  0  - success
+  -1 - if thread could not be started
+  -2 - if parameters are incorrect
+  -3 - if memory allocation unsuccess
+*/
+extern int group_commit_start(group_commit_t* group, PGconn* conn, const char* queue_name, int max_events,
+    int64_t max_delay_usec);
+
+/*
+Writes all submitted events, stops background thread and releases memory. Waits until
+group_commit_wait() has returned for every submitted request, so every request must be waited
+for. The group must not be used after that.
+*/
+extern void group_commit_stop(group_commit_t* group);
+
+/* Generates new event in the next group. Blocks until the group is committed, returns event id or -1 if fails */
+extern event_id_t group_commit_insert_event(group_commit_t* group, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+
+/*
+Puts new event into the next group and returns immediately. 'request' is owned by caller and
+must live until group_commit_wait() returns.
+Returns
+  0  - success
+  -1 - if group commit is stopped
+*/
+extern int group_commit_submit(group_commit_t* group, group_request_t* request, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+
+/* Blocks until group of the request is committed, returns event id or -1 if fails */
+extern event_id_t group_commit_wait(group_commit_t* group, group_request_t* request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
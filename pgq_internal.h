@@ -0,0 +1,108 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_INTERNAL_H_INCLUDED
+#define PGQ_INTERNAL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "pgq.h"
+
+/* Helpers shared between pgq*.c files, not a part of public API */
+
+#define ARRAY_SIZE(array) (sizeof(array)/sizeof(array[0]))
+
+#define MEMORY_ALLOC_ERR "Could not allocate %d bytes"
+
+/* Difference between unix epoch and PostgreSQL epoch (2000-01-01) in microseconds */
+#define POSTGRES_EPOCH_USEC 946684800000000LL
+
+/* Stores error which will be returned by get_error_number()/get_error_text() */
+extern void set_error(int number, const char* format, ...);
+
+/*
+Returns how many chars of ev_data fit into the query of insert_event()/insert_event_ex() with
+given arguments, NULL extras are counted as empty.
+*/
+extern size_t insert_event_data_room(const char* queue_name, const char* ev_type,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+
+/* Copies error of current thread into given buffers, so another thread can pass it to set_error() */
+static inline void save_error(int* number, char* text, size_t size) {
+  *number = get_error_number();
+  strncpy(text, get_error_text(), size - 1);
+  text[size - 1] = '\0';
+}
+
+/* Copies at most size - 1 chars and always terminates 'dst', NULL is copied as empty string */
+static inline void copy_field(char* dst, const char* src, size_t size) {
+  if (!src)
+    src = "";
+  strncpy(dst, src, size - 1);
+  dst[size - 1] = '\0';
+}
+
+/* Wall clock time in microseconds since unix epoch, comparable with database timestamps */
+static inline int64_t realtime_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Monotonic time in microseconds, for intervals and deadlines */
+static inline int64_t monotonic_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define FNV_OFFSET_BASIS 2166136261u
+
+/* Adds string with its terminating zero to FNV-1a hash, so several strings may be chained */
+static inline uint32_t fnv_hash(uint32_t hash, const char* str) {
+  do {
+    hash ^= (uint8_t)*str;
+    hash *= 16777619u;
+  } while (*str++);
+  return hash;
+}
+
+#define MAX_LATENCY_STAMP_LENGTH 24
+
+/*
+Writes produce time stamp into 'stamp' if latency tracking is enabled.
+Returns number of extra field (1-4) the stamp must be stored into, or 0 if tracking is disabled.
+*/
+extern int latency_stamp(char* stamp, size_t size);
+
+/*
+Points extra field chosen for latency tracking at produce time stamp written into 'stamp', if the
+field is empty or NULL. 'extras' holds 4 extra fields of the event.
+*/
+static inline void stamp_extras(const char* extras[4], char* stamp, size_t size) {
+  int field = latency_stamp(stamp, size);
+  if (field && (!extras[field - 1] || !*extras[field - 1]))
+    extras[field - 1] = stamp;
+}
+
+#endif
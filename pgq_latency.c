@@ -0,0 +1,255 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pgq_latency.h"
+#include "pgq_internal.h"
+
+#define SERIES_EMPTY      0
+#define SERIES_CLAIMED    1
+#define SERIES_READY      2
+
+typedef struct {
+  _Atomic uint64_t  count;
+  _Atomic uint64_t  sum_usec;
+  _Atomic uint64_t  max_usec;
+  _Atomic uint64_t  buckets[LATENCY_BUCKETS];
+} stage_histogram_t;
+
+/* Names are written once by the thread which claimed the series and are read only after READY */
+typedef struct {
+  _Atomic int         state;
+  char                queue_name[MAX_QUEUE_NAME_LENGTH];
+  char                ev_type[MAX_EVENT_TYPE_LENGTH];
+  stage_histogram_t   stages[LATENCY_STAGES];
+} latency_series_t;
+
+/* Marks values written by latency_stamp(), so user values of the field are not taken for time */
+#define STAMP_PREFIX "t:"
+
+static _Atomic int stamp_field = 0;
+static _Atomic int read_field = 0;
+static latency_series_t series[LATENCY_MAX_SERIES];
+
+static const char* STAGE_NAMES[LATENCY_STAGES] = {
+  "enqueue_to_tick",
+  "tick_to_fetch",
+  "fetch_to_finish"
+};
+
+void latency_tracking_enable(int extra_field) {
+  atomic_store(&stamp_field, (extra_field >= 1 && extra_field <= 4) ? extra_field : 0);
+}
+
+void latency_reading_enable(int extra_field) {
+  atomic_store(&read_field, (extra_field >= 1 && extra_field <= 4) ? extra_field : 0);
+}
+
+int latency_stamp(char* stamp, size_t size) {
+  int field = atomic_load_explicit(&stamp_field, memory_order_relaxed);
+  if (field)
+    snprintf(stamp, size, STAMP_PREFIX "%ld", (long)realtime_usec());
+  return field;
+}
+
+static uint32_t hash_series(const char* queue_name, const char* ev_type) {
+  return fnv_hash(fnv_hash(FNV_OFFSET_BASIS, queue_name), ev_type);
+}
+
+static int series_matches(latency_series_t* s, const char* queue_name, const char* ev_type) {
+  return strncmp(s->queue_name, queue_name, ARRAY_SIZE(s->queue_name) - 1) == 0 &&
+      strncmp(s->ev_type, ev_type, ARRAY_SIZE(s->ev_type) - 1) == 0;
+}
+
+/* Finds series of queue and event type, creates it if 'create' is set. Returns NULL if table is full */
+static latency_series_t* find_series(const char* queue_name, const char* ev_type, int create) {
+  uint32_t slot = hash_series(queue_name, ev_type) % LATENCY_MAX_SERIES;
+  latency_series_t* s;
+  int i, state;
+
+  for (i = 0; i < LATENCY_MAX_SERIES; ++i, slot = (slot + 1) % LATENCY_MAX_SERIES) {
+    s = &series[slot];
+    state = atomic_load_explicit(&s->state, memory_order_acquire);
+    if (state == SERIES_EMPTY) {
+      if (!create)
+        return NULL;
+      if (atomic_compare_exchange_strong(&s->state, &state, SERIES_CLAIMED)) {
+        strncpy(s->queue_name, queue_name, ARRAY_SIZE(s->queue_name) - 1);
+        strncpy(s->ev_type, ev_type, ARRAY_SIZE(s->ev_type) - 1);
+        atomic_store_explicit(&s->state, SERIES_READY, memory_order_release);
+        return s;
+      }
+    }
+    /* another thread is writing names right now */
+    while (state == SERIES_CLAIMED)
+      state = atomic_load_explicit(&s->state, memory_order_acquire);
+    if (series_matches(s, queue_name, ev_type))
+      return s;
+  }
+  return NULL;
+}
+
+static int bucket_of(uint64_t usec) {
+  int bucket = 0;
+  while (usec > 1 && bucket < LATENCY_BUCKETS - 1) {
+    usec >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+static void record(latency_series_t* s, latency_stage_t stage, int64_t usec) {
+  stage_histogram_t* h = &s->stages[stage];
+  uint64_t value = usec > 0 ? (uint64_t)usec : 0;
+  uint64_t max = atomic_load_explicit(&h->max_usec, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum_usec, value, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->buckets[bucket_of(value)], 1, memory_order_relaxed);
+  while (value > max && !atomic_compare_exchange_weak(&h->max_usec, &max, value))
+    ;
+}
+
+/* Returns produce time of event in microseconds since unix epoch */
+static int64_t produce_time(const event_t* event) {
+  const char* stamp;
+  char* end;
+  int64_t usec;
+  switch (atomic_load_explicit(&read_field, memory_order_relaxed)) {
+    case 1: stamp = event->extra1; break;
+    case 2: stamp = event->extra2; break;
+    case 3: stamp = event->extra3; break;
+    case 4: stamp = event->extra4; break;
+    default: stamp = ""; break;
+  }
+  if (strncmp(stamp, STAMP_PREFIX, strlen(STAMP_PREFIX)) == 0) {
+    stamp += strlen(STAMP_PREFIX);
+    usec = strtoll(stamp, &end, 10);
+    if (*stamp && !*end)
+      return usec;
+  }
+  return (int64_t)event->time + POSTGRES_EPOCH_USEC;
+}
+
+int64_t latency_record_fetch(const batch_info_t* batch_info, const event_t* events, int nevents) {
+  int64_t fetch_usec = realtime_usec();
+  int64_t tick_usec = (int64_t)batch_info->batch_end + POSTGRES_EPOCH_USEC;
+  latency_series_t* s = NULL;
+  int i;
+
+  for (i = 0; i < nevents; ++i) {
+    /* events of one type usually go in a row */
+    if (!s || !series_matches(s, batch_info->queue_name, events[i].type))
+      s = find_series(batch_info->queue_name, events[i].type, 1);
+    if (!s)
+      continue;
+    record(s, LATENCY_ENQUEUE_TO_TICK, tick_usec - produce_time(&events[i]));
+    record(s, LATENCY_TICK_TO_FETCH, fetch_usec - tick_usec);
+  }
+  return fetch_usec;
+}
+
+void latency_record_finish(const batch_info_t* batch_info, const event_t* events, int nevents, int64_t fetch_usec) {
+  int64_t finish_usec = realtime_usec();
+  latency_series_t* s = NULL;
+  int i;
+
+  for (i = 0; i < nevents; ++i) {
+    if (!s || !series_matches(s, batch_info->queue_name, events[i].type))
+      s = find_series(batch_info->queue_name, events[i].type, 1);
+    if (s)
+      record(s, LATENCY_FETCH_TO_FINISH, finish_usec - fetch_usec);
+  }
+}
+
+static void copy_histogram(stage_histogram_t* src, latency_histogram_t* dst) {
+  int i;
+  dst->count = atomic_load_explicit(&src->count, memory_order_relaxed);
+  dst->sum_usec = atomic_load_explicit(&src->sum_usec, memory_order_relaxed);
+  dst->max_usec = atomic_load_explicit(&src->max_usec, memory_order_relaxed);
+  for (i = 0; i < LATENCY_BUCKETS; ++i) {
+    dst->buckets[i] = atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+  }
+}
+
+int latency_get_histogram(const char* queue_name, const char* ev_type, latency_stage_t stage,
+    latency_histogram_t* histogram) {
+  latency_series_t* s = find_series(queue_name, ev_type, 0);
+  if (!s || stage < 0 || stage >= LATENCY_STAGES)
+    return 0;
+  copy_histogram(&s->stages[stage], histogram);
+  return 1;
+}
+
+int64_t latency_percentile(const latency_histogram_t* histogram, double p) {
+  uint64_t total = 0, rank;
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS; ++i) {
+    total += histogram->buckets[i];
+  }
+  if (total == 0)
+    return 0;
+  rank = (uint64_t)(total * p / 100.0);
+  if (rank >= total)
+    rank = total - 1;
+  for (i = 0; i < LATENCY_BUCKETS; ++i) {
+    if (rank < histogram->buckets[i])
+      break;
+    rank -= histogram->buckets[i];
+  }
+  if (i >= LATENCY_BUCKETS - 1)
+    return (int64_t)histogram->max_usec;
+  /* upper bound of the bucket, but never more than observed maximum */
+  return (int64_t)((2ull << i) < histogram->max_usec ? (2ull << i) : histogram->max_usec);
+}
+
+void print_latency(FILE* f) {
+  latency_histogram_t h;
+  int i, stage;
+  for (i = 0; i < LATENCY_MAX_SERIES; ++i) {
+    if (atomic_load_explicit(&series[i].state, memory_order_acquire) != SERIES_READY)
+      continue;
+    fprintf(f, "queue name:           %s\n",  series[i].queue_name);
+    fprintf(f, "type:                 %s\n",  series[i].ev_type);
+    for (stage = 0; stage < LATENCY_STAGES; ++stage) {
+      copy_histogram(&series[i].stages[stage], &h);
+      fprintf(f, "%-22s count=%lu avg=%luus p50=%ldus p99=%ldus max=%luus\n", STAGE_NAMES[stage],
+          (unsigned long)h.count, (unsigned long)(h.count ? h.sum_usec / h.count : 0),
+          (long)latency_percentile(&h, 50), (long)latency_percentile(&h, 99), (unsigned long)h.max_usec);
+    }
+  }
+}
+
+void latency_reset() {
+  int i, stage, b;
+  for (i = 0; i < LATENCY_MAX_SERIES; ++i) {
+    for (stage = 0; stage < LATENCY_STAGES; ++stage) {
+      stage_histogram_t* h = &series[i].stages[stage];
+      atomic_store(&h->count, 0);
+      atomic_store(&h->sum_usec, 0);
+      atomic_store(&h->max_usec, 0);
+      for (b = 0; b < LATENCY_BUCKETS; ++b) {
+        atomic_store(&h->buckets[b], 0);
+      }
+    }
+  }
+}
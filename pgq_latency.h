@@ -0,0 +1,105 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_LATENCY_H_INCLUDED
+#define PGQ_LATENCY_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "pgq.h"
+
+/*
+End-to-end latency of events.
+When tracking is enabled, producing functions of pgq.h store produce time into chosen extra
+field of every event unless the field is already filled. The stamp is 't:' followed by
+microseconds since unix epoch. Buffering producers take produce time when event is buffered,
+not when it is written.
+Consumers report fetched and finished batches, and latency of every stage is collected per
+queue and event type into lock-free histograms which may be read from any thread. Consumers
+read stamps from the field set by latency_reading_enable(), events without stamp (including
+ones whose field holds user value) use ev_time instead. Stages are measured with clocks of
+different hosts (producer, database, consumer), so they include clock skew between them.
+*/
+
+/* Histogram bucket N holds latencies in [2^N, 2^(N+1)) microseconds, bucket 0 also holds 0 */
+#define LATENCY_BUCKETS           40
+#define LATENCY_MAX_SERIES        256
+
+typedef enum {
+  LATENCY_ENQUEUE_TO_TICK,      /* produce time stamp -> tick which closed the batch */
+  LATENCY_TICK_TO_FETCH,        /* tick -> events received by consumer */
+  LATENCY_FETCH_TO_FINISH,      /* events received -> batch finished */
+  LATENCY_STAGES
+} latency_stage_t;
+
+typedef struct {
+  uint64_t    count;
+  uint64_t    sum_usec;
+  uint64_t    max_usec;
+  uint64_t    buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enables stamping of produced events into extra field 'extra_field' (1-4), 0 disables it */
+extern void latency_tracking_enable(int extra_field);
+
+/*
+Makes latency_record_fetch() take produce time from stamps in extra field 'extra_field' (1-4),
+0 makes it use ev_time. Independent of latency_tracking_enable(), so a consumer does not have
+to stamp events it produces itself.
+*/
+extern void latency_reading_enable(int extra_field);
+
+/*
+Records enqueue-to-tick and tick-to-fetch latencies of just fetched batch.
+Returns fetch time which must be passed to latency_record_finish().
+*/
+extern int64_t latency_record_fetch(const batch_info_t* batch_info, const event_t* events, int nevents);
+
+/* Records fetch-to-finish latency of the batch, should be called after finish_batch() */
+extern void latency_record_finish(const batch_info_t* batch_info, const event_t* events, int nevents, int64_t fetch_usec);
+
+/*
+Copies histogram of the stage for queue and event type into 'histogram'.
+Returns
+  1  - success
+  0  - if nothing has been recorded for queue and event type
+*/
+extern int latency_get_histogram(const char* queue_name, const char* ev_type, latency_stage_t stage,
+    latency_histogram_t* histogram);
+
+/* Returns upper bound of latency in microseconds for percentile 'p' (0-100) */
+extern int64_t latency_percentile(const latency_histogram_t* histogram, double p);
+
+/* Prints count, average, p50, p99 and max of every stage of every queue and event type */
+extern void print_latency(FILE* f);
+
+/* Drops all recorded values */
+extern void latency_reset();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
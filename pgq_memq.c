@@ -0,0 +1,707 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pgq_backend.h"
+#include "pgq_internal.h"
+
+/*
+Memory queue used by in-process and shared memory backends.
+Everything lives in one block without pointers, so the block may be mapped at different
+addresses by different processes:
+  memq_t | memq_queue_t[max_queues] | memq_event_t[max_queues * ring_size]
+Events of a queue are stored in a ring indexed by sequence number. Slots are reused only when
+no consumer position and no pending retry refers to them, otherwise insert fails.
+Retried events are appended to the ring again and belong to the consumer which retried them,
+other consumers skip them.
+Shared mutex is robust, so a process which dies holding it does not block others.
+*/
+
+#define MEMQ_MAGIC                0x50475131
+#define MEMQ_MAX_CONSUMERS        16
+#define MEMQ_MAX_TICKS            1024
+#define MEMQ_MAX_RETRY            1024
+
+static const char* INCORRECT_SIZES_ERR = "Incorrect amount of queues %d or ring size %d";
+static const char* SYSTEM_CALL_ERR = "%s failed: %s";
+static const char* QUEUE_NOT_FOUND_ERR = "Queue %s is not found";
+static const char* TOO_MANY_QUEUES_ERR = "Could not create queue %s, all %d queues are in use";
+static const char* QUEUE_HAS_CONSUMERS_ERR = "Queue %s has registered consumers";
+static const char* TOO_MANY_CONSUMERS_ERR = "Could not register consumer %s, all %d consumers are in use";
+static const char* CONSUMER_NOT_FOUND_ERR = "Consumer %s is not registered on queue %s";
+static const char* QUEUE_FULL_ERR = "Queue %s is full, %d events are not consumed yet";
+static const char* TOO_MANY_TICKS_ERR = "Queue %s has %d ticks not consumed yet";
+static const char* TOO_MANY_RETRIES_ERR = "Queue %s has %d events waiting for retry";
+static const char* BATCH_NOT_FOUND_ERR = "Batch %ld is not found";
+static const char* SHM_NOT_READY_ERR = "Shared memory %s is not initialized";
+
+typedef struct {
+  tick_id_t   id;
+  seq_t       seq;          /* sequence of the first event after the tick */
+  timestamp   time;
+} memq_tick_t;
+
+typedef struct {
+  int         used;
+  char        name[MAX_CONSUMER_NAME_LENGTH];
+  tick_id_t   last_tick;
+  batch_id_t  batch_id;
+  tick_id_t   batch_tick;
+} memq_consumer_t;
+
+typedef struct {
+  seq_t       seq;
+  int         consumer;     /* index of consumer which retried the event */
+  int64_t     due_usec;
+} memq_retry_t;
+
+typedef struct {
+  int               used;
+  char              name[MAX_QUEUE_NAME_LENGTH];
+  event_id_t        last_event_id;
+  seq_t             head;
+  tick_id_t         last_tick;
+  int               nretry;
+  memq_tick_t       ticks[MEMQ_MAX_TICKS];
+  memq_consumer_t   consumers[MEMQ_MAX_CONSUMERS];
+  memq_retry_t      retry[MEMQ_MAX_RETRY];
+} memq_queue_t;
+
+typedef struct {
+  event_t     event;
+  int         consumer;     /* index of consumer which gets the event, -1 for all */
+} memq_event_t;
+
+typedef struct {
+  uint32_t          magic;
+  int               max_queues;
+  int               ring_size;
+  size_t            size;
+  batch_id_t        last_batch_id;
+  pthread_mutex_t   lock;
+} memq_t;
+
+static size_t memq_size(int max_queues, int ring_size) {
+  return sizeof(memq_t) + max_queues * sizeof(memq_queue_t) + (size_t)max_queues * ring_size * sizeof(memq_event_t);
+}
+
+static memq_queue_t* memq_queue(memq_t* mq, int index) {
+  return (memq_queue_t*)((char*)mq + sizeof(memq_t)) + index;
+}
+
+static memq_event_t* memq_slot(memq_t* mq, memq_queue_t* q, seq_t seq) {
+  memq_event_t* events = (memq_event_t*)((char*)mq + sizeof(memq_t) + mq->max_queues * sizeof(memq_queue_t));
+  int index = (int)(q - memq_queue(mq, 0));
+  return &events[(size_t)index * mq->ring_size + seq % mq->ring_size];
+}
+
+static event_t* memq_event(memq_t* mq, memq_queue_t* q, seq_t seq) {
+  return &memq_slot(mq, q, seq)->event;
+}
+
+static memq_tick_t* memq_tick(memq_queue_t* q, tick_id_t tick_id) {
+  return &q->ticks[tick_id % MEMQ_MAX_TICKS];
+}
+
+static int memq_init(memq_t* mq, int max_queues, int ring_size, int shared) {
+  pthread_mutexattr_t attr;
+  int err;
+
+  memset(mq, 0, sizeof(memq_t) + max_queues * sizeof(memq_queue_t));
+  mq->max_queues = max_queues;
+  mq->ring_size = ring_size;
+  mq->size = memq_size(max_queues, ring_size);
+  pthread_mutexattr_init(&attr);
+  if (shared) {
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  }
+  err = pthread_mutex_init(&mq->lock, &attr);
+  if (err != 0) {
+    pthread_mutexattr_destroy(&attr);
+    set_error(0, SYSTEM_CALL_ERR, "pthread_mutex_init", strerror(err));
+    return -1;
+  }
+  pthread_mutexattr_destroy(&attr);
+  __atomic_store_n(&mq->magic, MEMQ_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*
+If another process died holding the lock, its last change may be incomplete. Every change
+keeps the queue usable when interrupted (at worst an event or retry is lost), so the lock
+is just marked consistent.
+*/
+static void memq_lock(memq_t* mq) {
+  if (pthread_mutex_lock(&mq->lock) == EOWNERDEAD)
+    pthread_mutex_consistent(&mq->lock);
+}
+
+static memq_queue_t* find_queue(memq_t* mq, const char* queue_name) {
+  int i;
+  for (i = 0; i < mq->max_queues; ++i) {
+    if (memq_queue(mq, i)->used && strcmp(memq_queue(mq, i)->name, queue_name) == 0)
+      return memq_queue(mq, i);
+  }
+  set_error(0, QUEUE_NOT_FOUND_ERR, queue_name);
+  return NULL;
+}
+
+static memq_consumer_t* find_consumer(memq_queue_t* q, const char* consumer_name) {
+  int i;
+  for (i = 0; i < MEMQ_MAX_CONSUMERS; ++i) {
+    if (q->consumers[i].used && strcmp(q->consumers[i].name, consumer_name) == 0)
+      return &q->consumers[i];
+  }
+  return NULL;
+}
+
+static memq_consumer_t* find_batch(memq_t* mq, batch_id_t batch_id, memq_queue_t** queue) {
+  int i, j;
+  for (i = 0; i < mq->max_queues; ++i) {
+    memq_queue_t* q = memq_queue(mq, i);
+    if (!q->used)
+      continue;
+    for (j = 0; j < MEMQ_MAX_CONSUMERS; ++j) {
+      if (q->consumers[j].used && q->consumers[j].batch_id == batch_id) {
+        *queue = q;
+        return &q->consumers[j];
+      }
+    }
+  }
+  set_error(0, BATCH_NOT_FOUND_ERR, batch_id);
+  return NULL;
+}
+
+/* Oldest event which is still referenced by consumers or retry queue */
+static seq_t oldest_needed_seq(memq_queue_t* q) {
+  seq_t oldest = q->head, seq;
+  int i;
+  for (i = 0; i < MEMQ_MAX_CONSUMERS; ++i) {
+    if (!q->consumers[i].used)
+      continue;
+    seq = memq_tick(q, q->consumers[i].last_tick)->seq;
+    if (seq < oldest)
+      oldest = seq;
+  }
+  for (i = 0; i < q->nretry; ++i) {
+    if (q->retry[i].seq < oldest)
+      oldest = q->retry[i].seq;
+  }
+  return oldest;
+}
+
+/* Appends event for the consumer with index 'consumer', -1 means all consumers */
+static int append_event(memq_t* mq, memq_queue_t* q, const event_t* event, int consumer) {
+  memq_event_t* slot;
+  if (q->head - oldest_needed_seq(q) >= mq->ring_size) {
+    set_error(0, QUEUE_FULL_ERR, q->name, mq->ring_size);
+    return -1;
+  }
+  slot = memq_slot(mq, q, q->head);
+  memcpy(&slot->event, event, sizeof(event_t));
+  slot->consumer = consumer;
+  ++q->head;
+  return 0;
+}
+
+static tick_id_t add_tick(memq_queue_t* q) {
+  memq_tick_t* tick;
+  int i;
+  /* slot of the new tick must not be referenced by any consumer */
+  for (i = 0; i < MEMQ_MAX_CONSUMERS; ++i) {
+    if (q->consumers[i].used && q->consumers[i].last_tick <= q->last_tick + 1 - MEMQ_MAX_TICKS) {
+      set_error(0, TOO_MANY_TICKS_ERR, q->name, MEMQ_MAX_TICKS);
+      return -1;
+    }
+  }
+  tick = memq_tick(q, ++q->last_tick);
+  tick->id = q->last_tick;
+  tick->seq = q->head;
+  tick->time = (timestamp)(realtime_usec() - POSTGRES_EPOCH_USEC);
+  return tick->id;
+}
+
+static int memq_create_queue(void* ctx, const char* queue_name) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q = NULL;
+  int i, ret = 1;
+
+  memq_lock(mq);
+  for (i = 0; i < mq->max_queues; ++i) {
+    memq_queue_t* cur = memq_queue(mq, i);
+    if (cur->used && strcmp(cur->name, queue_name) == 0) {
+      ret = 0;
+      break;
+    }
+    if (!cur->used && !q)
+      q = cur;
+  }
+  if (ret == 1 && !q) {
+    set_error(0, TOO_MANY_QUEUES_ERR, queue_name, mq->max_queues);
+    ret = -1;
+  }
+  if (ret == 1) {
+    memset(q, 0, sizeof(memq_queue_t));
+    q->used = 1;
+    copy_field(q->name, queue_name, ARRAY_SIZE(q->name));
+    /* like PgQ, new queue starts with a tick, so consumers have position to register at */
+    add_tick(q);
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static int memq_drop_queue(void* ctx, const char* queue_name, int force) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  int ret = -1, i;
+
+  memq_lock(mq);
+  q = find_queue(mq, queue_name);
+  if (q) {
+    ret = 1;
+    for (i = 0; i < MEMQ_MAX_CONSUMERS && !force; ++i) {
+      if (q->consumers[i].used) {
+        set_error(0, QUEUE_HAS_CONSUMERS_ERR, queue_name);
+        ret = -1;
+        break;
+      }
+    }
+    if (ret == 1)
+      q->used = 0;
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static event_id_t memq_insert_event(void* ctx, const char* queue_name, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  event_t event;
+  event_id_t ret = -1;
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  const char* extras[4];
+
+  extras[0] = extra1;
+  extras[1] = extra2;
+  extras[2] = extra3;
+  extras[3] = extra4;
+  stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+
+  memset(&event, 0, sizeof(event));
+  event.time = (timestamp)(realtime_usec() - POSTGRES_EPOCH_USEC);
+  copy_field(event.type, ev_type, ARRAY_SIZE(event.type));
+  copy_field(event.data, ev_data, ARRAY_SIZE(event.data));
+  copy_field(event.extra1, extras[0], ARRAY_SIZE(event.extra1));
+  copy_field(event.extra2, extras[1], ARRAY_SIZE(event.extra2));
+  copy_field(event.extra3, extras[2], ARRAY_SIZE(event.extra3));
+  copy_field(event.extra4, extras[3], ARRAY_SIZE(event.extra4));
+
+  memq_lock(mq);
+  q = find_queue(mq, queue_name);
+  if (q) {
+    event.id = q->last_event_id + 1;
+    if (append_event(mq, q, &event, -1) == 0)
+      ret = ++q->last_event_id;
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static tick_id_t memq_tick_queue(void* ctx, const char* queue_name) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  memq_retry_t retry;
+  event_t event;
+  tick_id_t ret = -1;
+  int64_t now = realtime_usec();
+  int i;
+
+  memq_lock(mq);
+  q = find_queue(mq, queue_name);
+  if (q) {
+    /* retried events which are due go into this tick */
+    for (i = 0; i < q->nretry; ) {
+      if (q->retry[i].due_usec > now) {
+        ++i;
+        continue;
+      }
+      retry = q->retry[i];
+      memcpy(&event, memq_event(mq, q, retry.seq), sizeof(event_t));
+      ++event.retry;
+      q->retry[i] = q->retry[--q->nretry];
+      if (append_event(mq, q, &event, retry.consumer) != 0) {
+        q->retry[q->nretry++] = retry;
+        break;
+      }
+    }
+    ret = add_tick(q);
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static int memq_register_consumer(void* ctx, const char* queue_name, const char* consumer_name) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  int ret = -1, i;
+
+  memq_lock(mq);
+  q = find_queue(mq, queue_name);
+  if (q && find_consumer(q, consumer_name)) {
+    ret = 0;
+  } else if (q) {
+    for (i = 0; i < MEMQ_MAX_CONSUMERS; ++i) {
+      if (!q->consumers[i].used)
+        break;
+    }
+    if (i == MEMQ_MAX_CONSUMERS) {
+      set_error(0, TOO_MANY_CONSUMERS_ERR, consumer_name, MEMQ_MAX_CONSUMERS);
+    } else {
+      memset(&q->consumers[i], 0, sizeof(memq_consumer_t));
+      q->consumers[i].used = 1;
+      copy_field(q->consumers[i].name, consumer_name, ARRAY_SIZE(q->consumers[i].name));
+      q->consumers[i].last_tick = q->last_tick;
+      ret = 1;
+    }
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static int memq_unregister_consumer(void* ctx, const char* queue_name, const char* consumer_name) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  memq_consumer_t* consumer;
+  int ret = -1, index, i;
+
+  memq_lock(mq);
+  q = find_queue(mq, queue_name);
+  if (q) {
+    consumer = find_consumer(q, consumer_name);
+    if (consumer) {
+      consumer->used = 0;
+      index = (int)(consumer - q->consumers);
+      for (i = 0; i < q->nretry; ) {
+        if (q->retry[i].consumer == index)
+          q->retry[i] = q->retry[--q->nretry];
+        else
+          ++i;
+      }
+      ret = 1;
+    } else {
+      set_error(0, CONSUMER_NOT_FOUND_ERR, consumer_name, queue_name);
+    }
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static batch_id_t memq_next_batch(void* ctx, const char* queue_name, const char* consumer_name) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  memq_consumer_t* consumer;
+  batch_id_t ret = -1;
+
+  memq_lock(mq);
+  q = find_queue(mq, queue_name);
+  if (q) {
+    consumer = find_consumer(q, consumer_name);
+    if (!consumer) {
+      set_error(0, CONSUMER_NOT_FOUND_ERR, consumer_name, queue_name);
+    } else if (consumer->batch_id > 0) {
+      ret = consumer->batch_id;
+    } else if (consumer->last_tick < q->last_tick) {
+      consumer->batch_id = ++mq->last_batch_id;
+      consumer->batch_tick = consumer->last_tick + 1;
+      ret = consumer->batch_id;
+    } else {
+      ret = 0;
+    }
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static int memq_get_batch_events(void* ctx, batch_id_t batch_id, event_t** events) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  memq_consumer_t* consumer;
+  memq_event_t* slot;
+  seq_t seq, start, end;
+  int size = -1, index;
+
+  memq_lock(mq);
+  consumer = find_batch(mq, batch_id, &q);
+  if (consumer) {
+    start = memq_tick(q, consumer->last_tick)->seq;
+    end = memq_tick(q, consumer->batch_tick)->seq;
+    index = (int)(consumer - q->consumers);
+    *events = (event_t*)malloc((end - start)*sizeof(event_t));
+    if (!*events) {
+      set_error(0, MEMORY_ALLOC_ERR, (int)((end - start)*sizeof(event_t)));
+      size = -3;
+    } else {
+      size = 0;
+      for (seq = start; seq < end; ++seq) {
+        slot = memq_slot(mq, q, seq);
+        if (slot->consumer < 0 || slot->consumer == index)
+          memcpy(&(*events)[size++], &slot->event, sizeof(event_t));
+      }
+    }
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return size;
+}
+
+static int memq_get_batch_info(void* ctx, batch_id_t batch_id, batch_info_t** batch_info) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  memq_consumer_t* consumer;
+  int size = -1;
+
+  memq_lock(mq);
+  consumer = find_batch(mq, batch_id, &q);
+  if (consumer) {
+    *batch_info = (batch_info_t*)malloc(sizeof(batch_info_t));
+    if (!*batch_info) {
+      set_error(0, MEMORY_ALLOC_ERR, (int)sizeof(batch_info_t));
+      size = -3;
+    } else {
+      memset(*batch_info, 0, sizeof(batch_info_t));
+      copy_field(batch_info[0]->queue_name, q->name, ARRAY_SIZE(batch_info[0]->queue_name));
+      copy_field(batch_info[0]->consumer_name, consumer->name, ARRAY_SIZE(batch_info[0]->consumer_name));
+      batch_info[0]->batch_start = memq_tick(q, consumer->last_tick)->time;
+      batch_info[0]->batch_end = memq_tick(q, consumer->batch_tick)->time;
+      batch_info[0]->prev_tick_id = consumer->last_tick;
+      batch_info[0]->tick_id = consumer->batch_tick;
+      batch_info[0]->seq_start = memq_tick(q, consumer->last_tick)->seq;
+      batch_info[0]->seq_end = memq_tick(q, consumer->batch_tick)->seq;
+      size = 1;
+    }
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return size;
+}
+
+/* Puts events of the batch into retry queue, 'event_id' < 0 means all events */
+static int retry_events(memq_t* mq, batch_id_t batch_id, event_id_t event_id, int32_t retry_seconds) {
+  memq_queue_t* q;
+  memq_consumer_t* consumer;
+  memq_event_t* slot;
+  seq_t seq, end;
+  int ret = -1, index, i;
+
+  memq_lock(mq);
+  consumer = find_batch(mq, batch_id, &q);
+  if (consumer) {
+    ret = 0;
+    index = (int)(consumer - q->consumers);
+    end = memq_tick(q, consumer->batch_tick)->seq;
+    for (seq = memq_tick(q, consumer->last_tick)->seq; seq < end; ++seq) {
+      slot = memq_slot(mq, q, seq);
+      if ((slot->consumer >= 0 && slot->consumer != index) || (event_id >= 0 && slot->event.id != event_id))
+        continue;
+      for (i = 0; i < q->nretry && (q->retry[i].seq != seq || q->retry[i].consumer != index); ++i)
+        ;
+      if (i < q->nretry)
+        continue;
+      if (q->nretry == MEMQ_MAX_RETRY) {
+        set_error(0, TOO_MANY_RETRIES_ERR, q->name, MEMQ_MAX_RETRY);
+        ret = -1;
+        break;
+      }
+      q->retry[q->nretry].seq = seq;
+      q->retry[q->nretry].consumer = index;
+      q->retry[q->nretry].due_usec = realtime_usec() + (int64_t)retry_seconds * 1000000;
+      ++q->nretry;
+      ++ret;
+    }
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static int memq_batch_retry(void* ctx, batch_id_t batch_id, int32_t retry_seconds) {
+  return retry_events((memq_t*)ctx, batch_id, -1, retry_seconds);
+}
+
+static int memq_event_retry(void* ctx, batch_id_t batch_id, event_id_t event_id, int32_t retry_seconds) {
+  return retry_events((memq_t*)ctx, batch_id, event_id, retry_seconds);
+}
+
+static int memq_finish_batch(void* ctx, batch_id_t batch_id) {
+  memq_t* mq = (memq_t*)ctx;
+  memq_queue_t* q;
+  memq_consumer_t* consumer;
+  int ret = 0;
+
+  memq_lock(mq);
+  consumer = find_batch(mq, batch_id, &q);
+  if (consumer) {
+    consumer->last_tick = consumer->batch_tick;
+    consumer->batch_id = 0;
+    ret = 1;
+  }
+  pthread_mutex_unlock(&mq->lock);
+  return ret;
+}
+
+static void mem_close(void* ctx) {
+  memq_t* mq = (memq_t*)ctx;
+  pthread_mutex_destroy(&mq->lock);
+  free(mq);
+}
+
+static void shm_close(void* ctx) {
+  memq_t* mq = (memq_t*)ctx;
+  munmap(mq, mq->size);
+}
+
+static const backend_ops_t MEM_BACKEND_OPS = {
+  memq_create_queue,
+  memq_drop_queue,
+  memq_insert_event,
+  memq_tick_queue,
+  memq_register_consumer,
+  memq_unregister_consumer,
+  memq_next_batch,
+  memq_get_batch_events,
+  memq_get_batch_info,
+  memq_batch_retry,
+  memq_event_retry,
+  memq_finish_batch,
+  mem_close
+};
+
+static const backend_ops_t SHM_BACKEND_OPS = {
+  memq_create_queue,
+  memq_drop_queue,
+  memq_insert_event,
+  memq_tick_queue,
+  memq_register_consumer,
+  memq_unregister_consumer,
+  memq_next_batch,
+  memq_get_batch_events,
+  memq_get_batch_info,
+  memq_batch_retry,
+  memq_event_retry,
+  memq_finish_batch,
+  shm_close
+};
+
+int mem_backend_open(backend_t* backend, int max_queues, int ring_size) {
+  memq_t* mq;
+  size_t size;
+
+  if (max_queues <= 0 || ring_size <= 0) {
+    set_error(0, INCORRECT_SIZES_ERR, max_queues, ring_size);
+    return -2;
+  }
+  size = memq_size(max_queues, ring_size);
+  mq = (memq_t*)malloc(size);
+  if (!mq) {
+    set_error(0, MEMORY_ALLOC_ERR, (int)size);
+    return -3;
+  }
+  if (memq_init(mq, max_queues, ring_size, 0) != 0) {
+    free(mq);
+    return -1;
+  }
+  backend->ops = &MEM_BACKEND_OPS;
+  backend->ctx = mq;
+  return 0;
+}
+
+int shm_backend_open(backend_t* backend, const char* name, int max_queues, int ring_size) {
+  memq_t* mq;
+  memq_t header;
+  size_t size;
+  int fd, created = 1, i;
+
+  if (max_queues <= 0 || ring_size <= 0) {
+    set_error(0, INCORRECT_SIZES_ERR, max_queues, ring_size);
+    return -2;
+  }
+  size = memq_size(max_queues, ring_size);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    created = 0;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+  if (fd < 0) {
+    set_error(0, SYSTEM_CALL_ERR, "shm_open", strerror(errno));
+    return -1;
+  }
+  if (created) {
+    if (ftruncate(fd, size) != 0) {
+      set_error(0, SYSTEM_CALL_ERR, "ftruncate", strerror(errno));
+      close(fd);
+      shm_unlink(name);
+      return -1;
+    }
+  } else {
+    /* creator may still be initializing the segment, take sizes from its header */
+    for (i = 0; i < 1000; ++i) {
+      if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+          header.magic == MEMQ_MAGIC)
+        break;
+      usleep(1000);
+    }
+    if (i == 1000) {
+      set_error(0, SHM_NOT_READY_ERR, name);
+      close(fd);
+      return -1;
+    }
+    size = header.size;
+  }
+  mq = (memq_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mq == MAP_FAILED) {
+    set_error(0, SYSTEM_CALL_ERR, "mmap", strerror(errno));
+    return -1;
+  }
+  if (created && memq_init(mq, max_queues, ring_size, 1) != 0) {
+    munmap(mq, size);
+    shm_unlink(name);
+    return -1;
+  }
+  backend->ops = &SHM_BACKEND_OPS;
+  backend->ctx = mq;
+  return created;
+}
+
+int shm_backend_unlink(const char* name) {
+  if (shm_unlink(name) != 0) {
+    set_error(0, SYSTEM_CALL_ERR, "shm_unlink", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,311 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pgq_shard.h"
+#include "pgq_internal.h"
+
+static const char* INCORRECT_SHARDS_ERR = "Incorrect amount of shards %d or batch size %d";
+static const char* THREAD_CREATE_ERR = "Could not create thread for shard %d";
+
+/* Result of operation executed on a shard by separate thread */
+typedef struct {
+  const shard_t*  shard;
+  int             index;
+  int             ret;
+  int             error_number;
+  char            error_text[256];
+  /* producer */
+  const event_t*  events;
+  int             nevents;
+  /* consumer */
+  const char*     consumer_name;
+  batch_id_t      batch_id;
+  event_t*        batch_events;
+} shard_job_t;
+
+/* FNV-1a with murmur3 finalizer to spread close strings over the ring */
+static uint32_t hash_string(const char* str) {
+  uint32_t hash = fnv_hash(FNV_OFFSET_BASIS, str);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+static const char* not_null(const char* value) {
+  return value ? value : "";
+}
+
+static int compare_ring_points(const void* a, const void* b) {
+  uint32_t ha = ((const shard_ring_point_t*)a)->hash;
+  uint32_t hb = ((const shard_ring_point_t*)b)->hash;
+  return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+static void save_job_error(shard_job_t* job) {
+  save_error(&job->error_number, job->error_text, ARRAY_SIZE(job->error_text));
+}
+
+/* Runs 'routine' for every job in its own thread and returns amount of failed jobs */
+static int run_jobs(shard_job_t* jobs, int njobs, void* (*routine)(void*)) {
+  pthread_t threads[MAX_SHARDS];
+  int started[MAX_SHARDS];
+  int i, failed = 0;
+  for (i = 0; i < njobs; ++i) {
+    started[i] = pthread_create(&threads[i], NULL, routine, &jobs[i]) == 0;
+    if (!started[i]) {
+      jobs[i].ret = -1;
+      set_error(0, THREAD_CREATE_ERR, jobs[i].index);
+      save_job_error(&jobs[i]);
+    }
+  }
+  for (i = 0; i < njobs; ++i) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    if (jobs[i].ret < 0) {
+      if (failed++ == 0)
+        set_error(jobs[i].error_number, "%s", jobs[i].error_text);
+    }
+  }
+  return failed;
+}
+
+int sharded_producer_init(sharded_producer_t* producer, const shard_t* shards, int nshards, int batch_size) {
+  char identity[MAX_QUEUE_NAME_LENGTH + 512];
+  size_t size;
+  int i, j;
+
+  memset(producer, 0, sizeof(*producer));
+  if (nshards <= 0 || nshards > MAX_SHARDS || batch_size <= 0) {
+    set_error(0, INCORRECT_SHARDS_ERR, nshards, batch_size);
+    return -2;
+  }
+  producer->nshards = nshards;
+  producer->batch_size = batch_size;
+  producer->nring = nshards * SHARD_VIRTUAL_NODES;
+
+  size = nshards * sizeof(shard_t);
+  producer->shards = (shard_t*)malloc(size);
+  if (!producer->shards)
+    goto alloc_failed;
+  memcpy(producer->shards, shards, size);
+
+  size = producer->nring * sizeof(shard_ring_point_t);
+  producer->ring = (shard_ring_point_t*)malloc(size);
+  if (!producer->ring)
+    goto alloc_failed;
+
+  for (i = 0; i < nshards; ++i) {
+    size = batch_size * sizeof(event_t);
+    producer->pending[i] = (event_t*)malloc(size);
+    if (!producer->pending[i])
+      goto alloc_failed;
+    /* ring points depend on shard location only, not on its position in array */
+    for (j = 0; j < SHARD_VIRTUAL_NODES; ++j) {
+      snprintf(identity, ARRAY_SIZE(identity), "%s:%s/%s/%s#%d",
+          not_null(PQhost(shards[i].conn)), not_null(PQport(shards[i].conn)), not_null(PQdb(shards[i].conn)),
+          shards[i].queue_name, j);
+      producer->ring[i * SHARD_VIRTUAL_NODES + j].hash = hash_string(identity);
+      producer->ring[i * SHARD_VIRTUAL_NODES + j].shard = i;
+    }
+  }
+  qsort(producer->ring, producer->nring, sizeof(shard_ring_point_t), compare_ring_points);
+  return 0;
+
+alloc_failed:
+  set_error(0, MEMORY_ALLOC_ERR, (int)size);
+  sharded_producer_free(producer);
+  return -3;
+}
+
+void sharded_producer_free(sharded_producer_t* producer) {
+  int i;
+  for (i = 0; i < MAX_SHARDS; ++i) {
+    free(producer->pending[i]);
+    producer->pending[i] = NULL;
+    producer->npending[i] = 0;
+  }
+  free(producer->ring);
+  free(producer->shards);
+  producer->ring = NULL;
+  producer->shards = NULL;
+}
+
+int shard_for_key(const sharded_producer_t* producer, const char* key) {
+  uint32_t hash = hash_string(key);
+  int lo = 0, hi = producer->nring, mid;
+  /* first point clockwise from key's hash */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (producer->ring[mid].hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == producer->nring)
+    lo = 0;
+  return producer->ring[lo].shard;
+}
+
+int sharded_insert_event(sharded_producer_t* producer, const char* key, const char* ev_type, const char* ev_data) {
+  return sharded_insert_event_ex(producer, key, ev_type, ev_data, NULL, NULL, NULL, NULL);
+}
+
+int sharded_insert_event_ex(sharded_producer_t* producer, const char* key, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4) {
+  int shard = shard_for_key(producer, key);
+  char stamp[MAX_LATENCY_STAMP_LENGTH];
+  const char* extras[4];
+  event_t* event;
+
+  /* full buffer is written before the next event, so failure never concerns the buffered event */
+  if (producer->npending[shard] == producer->batch_size && sharded_flush(producer) < 0)
+    return -1;
+  /* produce time is taken here, not when the buffer is written */
+  extras[0] = extra1;
+  extras[1] = extra2;
+  extras[2] = extra3;
+  extras[3] = extra4;
+  stamp_extras(extras, stamp, ARRAY_SIZE(stamp));
+
+  event = &producer->pending[shard][producer->npending[shard]++];
+  copy_field(event->type, ev_type, ARRAY_SIZE(event->type));
+  copy_field(event->data, ev_data, ARRAY_SIZE(event->data));
+  copy_field(event->extra1, extras[0], ARRAY_SIZE(event->extra1));
+  copy_field(event->extra2, extras[1], ARRAY_SIZE(event->extra2));
+  copy_field(event->extra3, extras[2], ARRAY_SIZE(event->extra3));
+  copy_field(event->extra4, extras[3], ARRAY_SIZE(event->extra4));
+  return shard;
+}
+
+static void* flush_shard(void* arg) {
+  shard_job_t* job = (shard_job_t*)arg;
+  job->ret = insert_events(job->shard->conn, job->shard->queue_name, job->events, job->nevents, NULL);
+  if (job->ret < 0)
+    save_job_error(job);
+  return NULL;
+}
+
+int sharded_flush(sharded_producer_t* producer) {
+  shard_job_t jobs[MAX_SHARDS];
+  int njobs = 0, i, written = 0, failed;
+
+  for (i = 0; i < producer->nshards; ++i) {
+    if (producer->npending[i] == 0)
+      continue;
+    memset(&jobs[njobs], 0, sizeof(shard_job_t));
+    jobs[njobs].shard = &producer->shards[i];
+    jobs[njobs].index = i;
+    jobs[njobs].events = producer->pending[i];
+    jobs[njobs].nevents = producer->npending[i];
+    ++njobs;
+  }
+  failed = run_jobs(jobs, njobs, flush_shard);
+  for (i = 0; i < njobs; ++i) {
+    if (jobs[i].ret >= 0) {
+      producer->npending[jobs[i].index] = 0;
+      written += jobs[i].ret;
+    }
+  }
+  return failed ? -1 : written;
+}
+
+static void* fetch_shard_batch(void* arg) {
+  shard_job_t* job = (shard_job_t*)arg;
+  job->batch_id = next_batch(job->shard->conn, job->shard->queue_name, job->consumer_name);
+  if (job->batch_id <= 0) {
+    job->ret = (int)job->batch_id;
+  } else {
+    job->ret = get_batch_events(job->shard->conn, job->batch_id, &job->batch_events);
+  }
+  if (job->ret < 0)
+    save_job_error(job);
+  return NULL;
+}
+
+int sharded_next_batches(const shard_t* shards, int nshards, const char* consumer_name, shard_batch_t* batches) {
+  shard_job_t jobs[MAX_SHARDS];
+  int i, n = 0, failed;
+
+  if (nshards <= 0 || nshards > MAX_SHARDS) {
+    set_error(0, INCORRECT_SHARDS_ERR, nshards, 0);
+    return -1;
+  }
+  for (i = 0; i < nshards; ++i) {
+    memset(&jobs[i], 0, sizeof(shard_job_t));
+    jobs[i].shard = &shards[i];
+    jobs[i].index = i;
+    jobs[i].consumer_name = consumer_name;
+  }
+  failed = run_jobs(jobs, nshards, fetch_shard_batch);
+  for (i = 0; i < nshards; ++i) {
+    if (jobs[i].ret < 0 || jobs[i].batch_id <= 0)
+      continue;
+    if (failed) {
+      free(jobs[i].batch_events);
+      continue;
+    }
+    batches[n].shard = i;
+    batches[n].batch_id = jobs[i].batch_id;
+    batches[n].events = jobs[i].batch_events;
+    batches[n].nevents = jobs[i].ret;
+    ++n;
+  }
+  return failed ? -1 : n;
+}
+
+static void* finish_shard_batch(void* arg) {
+  shard_job_t* job = (shard_job_t*)arg;
+  job->ret = finish_batch(job->shard->conn, job->batch_id);
+  if (job->ret < 0)
+    save_job_error(job);
+  return NULL;
+}
+
+int sharded_finish_batches(const shard_t* shards, shard_batch_t* batches, int nbatches) {
+  shard_job_t jobs[MAX_SHARDS];
+  int i, finished = 0, failed;
+
+  if (nbatches > MAX_SHARDS) {
+    set_error(0, INCORRECT_SHARDS_ERR, nbatches, 0);
+    return -1;
+  }
+  for (i = 0; i < nbatches; ++i) {
+    memset(&jobs[i], 0, sizeof(shard_job_t));
+    jobs[i].shard = &shards[batches[i].shard];
+    jobs[i].index = batches[i].shard;
+    jobs[i].batch_id = batches[i].batch_id;
+  }
+  failed = run_jobs(jobs, nbatches, finish_shard_batch);
+  for (i = 0; i < nbatches; ++i) {
+    if (jobs[i].ret > 0)
+      ++finished;
+    free(batches[i].events);
+    batches[i].events = NULL;
+    batches[i].nevents = 0;
+  }
+  return failed ? -1 : finished;
+}
@@ -0,0 +1,128 @@
+/*
+ *
+ * (C) 2013 - Denis Korablev <korden_nn@mail.ru>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PGQ_SHARD_H_INCLUDED
+#define PGQ_SHARD_H_INCLUDED
+
+#include <stdint.h>
+
+#include "pgq.h"
+
+/*
+Sharded queues.
+A routing key is mapped to one of N shards (connection + queue) with consistent hashing, so all
+events of one key go to the same shard and keep their order, and adding a shard moves only about
+1/N of keys. Events are buffered per shard and written by insert_events() in parallel, one thread
+per shard. Each shard must have its own connection.
+*/
+
+#define MAX_SHARDS                64
+/* Amount of points of every shard on hash ring */
+#define SHARD_VIRTUAL_NODES       64
+
+typedef struct {
+  PGconn*     conn;
+  char        queue_name[MAX_QUEUE_NAME_LENGTH];
+} shard_t;
+
+typedef struct {
+  uint32_t    hash;
+  int         shard;
+} shard_ring_point_t;
+
+typedef struct {
+  shard_t*            shards;
+  int                 nshards;
+  shard_ring_point_t* ring;
+  int                 nring;
+  event_t*            pending[MAX_SHARDS];
+  int                 npending[MAX_SHARDS];
+  int                 batch_size;
+} sharded_producer_t;
+
+/* Batch received from one of shards */
+typedef struct {
+  int         shard;
+  batch_id_t  batch_id;
+  event_t*    events;
+  int         nevents;
+} shard_batch_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Initializes producer over 'nshards' shards. Events are buffered up to 'batch_size' events
+per shard, all shards are flushed when an event comes to a full shard.
+Returns
+  0  - success
+  -2 - if amount of shards or batch size is incorrect
+  -3 - if memory allocation unsuccess
+*/
+extern int sharded_producer_init(sharded_producer_t* producer, const shard_t* shards, int nshards, int batch_size);
+
+/* Releases producer's memory. Pending events are lost, call sharded_flush() before. */
+extern void sharded_producer_free(sharded_producer_t* producer);
+
+/* Returns index of shard which serves the routing key */
+extern int shard_for_key(const sharded_producer_t* producer, const char* key);
+
+/*
+Buffers new event into shard of the routing key, flushes all shards first when the shard is full.
+Returns
+  N  - index of shard the event is routed to
+  -1 - if flush fails (see sharded_flush()), the event is not buffered then
+*/
+extern int sharded_insert_event(sharded_producer_t* producer, const char* key, const char* ev_type, const char* ev_data);
+extern int sharded_insert_event_ex(sharded_producer_t* producer, const char* key, const char* ev_type, const char* ev_data,
+    const char* extra1, const char* extra2, const char* extra3, const char* extra4);
+
+/*
+Writes buffered events of all shards in parallel.
+Returns
+  N  - amount of written events
+  -1 - if any of shards fails, events of failed shards are kept buffered
+*/
+extern int sharded_flush(sharded_producer_t* producer);
+
+/*
+Allocates next batch on every shard in parallel and fetches its events.
+'batches' must have room for 'nshards' items, only shards which have batch are filled in.
+Returns
+  N  - amount of filled in items in 'batches' array
+  -1 - if any of shards fails. Nothing is returned then, unfinished batches of other shards
+       are given again by the next call
+*/
+extern int sharded_next_batches(const shard_t* shards, int nshards, const char* consumer_name, shard_batch_t* batches);
+
+/*
+Finishes batches received from sharded_next_batches() and frees their events.
+Returns
+  N  - amount of finished batches
+  -1 - if any of shards fails
+*/
+extern int sharded_finish_batches(const shard_t* shards, shard_batch_t* batches, int nbatches);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
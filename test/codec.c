@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pgq_codec.h"
+#include "pgq_internal.h"
+
+static int failures = 0;
+
+#define CHECK(expr) \
+  if (!(expr)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+    ++failures; \
+  }
+
+typedef struct {
+  int32_t   id;
+  double    price;
+  char      name[8];
+  uint8_t   raw[3];
+  int64_t   total;
+} order_t;
+
+static const field_t ORDER_V1_FIELDS[] = {
+  CODEC_FIELD(order_t, id,    FIELD_NUMBER),
+  CODEC_FIELD(order_t, price, FIELD_NUMBER),
+  CODEC_FIELD(order_t, name,  FIELD_STRING)
+};
+
+static const field_t ORDER_V2_FIELDS[] = {
+  CODEC_FIELD(order_t, id,    FIELD_NUMBER),
+  CODEC_FIELD(order_t, price, FIELD_NUMBER),
+  CODEC_FIELD(order_t, name,  FIELD_STRING),
+  CODEC_FIELD(order_t, raw,   FIELD_BYTES),
+  CODEC_FIELD(order_t, total, FIELD_NUMBER)
+};
+
+static const codec_t ORDER_V1 = CODEC("order", 1, ORDER_V1_FIELDS);
+static const codec_t ORDER_V2 = CODEC("order", 2, ORDER_V2_FIELDS);
+
+static void test_round_trip() {
+  char data[MAX_EVENT_DATA_LENGTH];
+  order_t in, out;
+  int len;
+
+  for (len = 0; len < (int)sizeof(in.name); ++len) {
+    memset(&in, 0, sizeof(in));
+    in.id = -5;
+    in.price = 3.25;
+    memset(in.name, 'x', len);
+    in.raw[0] = 1; in.raw[1] = 0; in.raw[2] = 255;
+    in.total = -1234567890123LL;
+    CHECK(encode_event_data(&ORDER_V2, &in, data, sizeof(data)) > 0);
+    memset(&out, 0, sizeof(out));
+    CHECK(decode_event_data(&ORDER_V2, data, &out) == 2);
+    CHECK(out.id == in.id && out.price == in.price && out.total == in.total);
+    CHECK(strcmp(out.name, in.name) == 0);
+    CHECK(memcmp(out.raw, in.raw, sizeof(in.raw)) == 0);
+  }
+}
+
+static void test_unterminated_string() {
+  char data[MAX_EVENT_DATA_LENGTH];
+  order_t in, out;
+  memset(&in, 0, sizeof(in));
+  memset(in.name, 'y', sizeof(in.name));
+  CHECK(encode_event_data(&ORDER_V1, &in, data, sizeof(data)) > 0);
+  CHECK(decode_event_data(&ORDER_V1, data, &out) == 1);
+  CHECK(strlen(out.name) == sizeof(out.name) - 1);
+}
+
+static void test_versions() {
+  char data[MAX_EVENT_DATA_LENGTH];
+  order_t in, out;
+  memset(&in, 0, sizeof(in));
+  in.id = 7;
+  strcpy(in.name, "abc");
+  in.total = 99;
+
+  /* older consumer skips appended fields */
+  CHECK(encode_event_data(&ORDER_V2, &in, data, sizeof(data)) > 0);
+  memset(&out, 0, sizeof(out));
+  CHECK(decode_event_data(&ORDER_V1, data, &out) == 2);
+  CHECK(out.id == 7 && strcmp(out.name, "abc") == 0 && out.total == 0);
+
+  /* newer consumer keeps its defaults for fields missing in older payload */
+  CHECK(encode_event_data(&ORDER_V1, &in, data, sizeof(data)) > 0);
+  memset(&out, 0, sizeof(out));
+  out.total = -1;
+  CHECK(decode_event_data(&ORDER_V2, data, &out) == 1);
+  CHECK(out.id == 7 && out.total == -1);
+}
+
+static void test_malformed() {
+  char data[MAX_EVENT_DATA_LENGTH];
+  event_t event;
+  order_t obj;
+
+  CHECK(decode_event_data(&ORDER_V2, "", &obj) == -1);
+  CHECK(decode_event_data(&ORDER_V2, "abc", &obj) == -1);
+  CHECK(decode_event_data(&ORDER_V2, "A=BC", &obj) == -1);
+  CHECK(decode_event_data(&ORDER_V2, "#$%^", &obj) == -1);
+  /* header says 3 fields, payload ends after id */
+  CHECK(decode_event_data(&ORDER_V2, "AQMBAAAA", &obj) == -1);
+
+  memset(&obj, 0, sizeof(obj));
+  CHECK(encode_event_data(&ORDER_V2, &obj, data, 8) == -1);
+
+  memset(&event, 0, sizeof(event));
+  strcpy(event.type, "other");
+  CHECK(decode_event(&ORDER_V2, &event, &obj) == -3);
+  CHECK(find_codec(&ORDER_V2, 1, "order") == &ORDER_V2);
+  CHECK(find_codec(&ORDER_V2, 1, "other") == NULL);
+}
+
+typedef struct {
+  char      text[760];
+} blob_t;
+
+static const field_t BLOB_FIELDS[] = {
+  CODEC_FIELD(blob_t, text, FIELD_STRING)
+};
+
+static const codec_t BLOB = CODEC("blob", 1, BLOB_FIELDS);
+
+static void test_query_limit() {
+  char data[MAX_EVENT_DATA_LENGTH];
+  size_t room = insert_event_data_room("q", "blob", NULL, NULL, NULL, NULL);
+  blob_t obj;
+  int len, ret = -1;
+
+  /* without connection an event which fits fails in DB operation, one which does not fit fails earlier */
+  memset(&obj, 0, sizeof(obj));
+  for (len = 0; len < (int)sizeof(obj.text) - 1; ++len) {
+    obj.text[len] = 'x';
+    ret = insert_typed_event(NULL, "q", &BLOB, &obj);
+    if (ret != -1)
+      break;
+  }
+  CHECK(ret == -2);
+  CHECK(encode_event_data(&BLOB, &obj, data, sizeof(data)) > (int)room);
+  obj.text[len] = '\0';
+  CHECK(encode_event_data(&BLOB, &obj, data, sizeof(data)) <= (int)room);
+  CHECK(insert_typed_event_ex(NULL, "q", &BLOB, &obj, "extra", NULL, NULL, NULL) == -2);
+}
+
+int main(int argc, char* argv[]) {
+  test_round_trip();
+  test_unterminated_string();
+  test_versions();
+  test_malformed();
+  test_query_limit();
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("codec: all checks passed\n");
+  return 0;
+}
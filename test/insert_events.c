@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pgq.h"
+
+static int failures = 0;
+
+#define CHECK(expr) \
+  if (!(expr)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+    ++failures; \
+  }
+
+static const char* QUEUE = "test_insert_events";
+static const char* CONSUMER = "test_insert_events_consumer";
+
+/* Values which break a statement unless they are escaped */
+static const char* VALUES[] = {
+  "it's",
+  "''",
+  "back\\slash",
+  "'); drop table pgq.queue; --"
+};
+
+int main(int argc, char* argv[]) {
+  event_t in[4];
+  event_t* out;
+  event_id_t ids[4];
+  batch_id_t batch_id;
+  int i, j, n;
+  PGconn* conn = PQconnectdb("dbname=test user=postgres port=5433");
+  if (PQstatus(conn) != CONNECTION_OK) {
+    fprintf(stderr, "Could not open DB connection: %s\n", PQerrorMessage(conn));
+    PQfinish(conn);
+    return 1;
+  }
+  CHECK(create_queue(conn, QUEUE) >= 0);
+  CHECK(register_consumer(conn, QUEUE, CONSUMER) >= 0);
+  /* skip events left by previous runs */
+  while ((batch_id = next_batch(conn, QUEUE, CONSUMER)) > 0)
+    finish_batch(conn, batch_id);
+
+  memset(in, 0, sizeof(in));
+  for (i = 0; i < 4; ++i) {
+    strcpy(in[i].type, VALUES[i]);
+    strcpy(in[i].data, VALUES[(i + 1) % 4]);
+    strcpy(in[i].extra2, VALUES[(i + 2) % 4]);
+  }
+  n = insert_events(conn, QUEUE, in, 4, ids);
+  if (n < 0)
+    fprintf(stderr, "insert_events: %s\n", get_error_text());
+  CHECK(n == 4);
+  CHECK(ticker(conn, QUEUE) > 0);
+
+  batch_id = next_batch(conn, QUEUE, CONSUMER);
+  CHECK(batch_id > 0);
+  n = get_batch_events(conn, batch_id, &out);
+  CHECK(n == 4);
+  for (i = 0; i < n; ++i) {
+    for (j = 0; j < 4 && ids[j] != out[i].id; ++j)
+      ;
+    CHECK(j < 4);
+    if (j == 4)
+      continue;
+    CHECK(strcmp(out[i].type, in[j].type) == 0);
+    CHECK(strcmp(out[i].data, in[j].data) == 0);
+    CHECK(out[i].extra1[0] == '\0' && strcmp(out[i].extra2, in[j].extra2) == 0);
+  }
+  if (n > 0)
+    free(out);
+  CHECK(finish_batch(conn, batch_id) == 1);
+
+  unregister_consumer(conn, QUEUE, CONSUMER);
+  drop_queue(conn, QUEUE);
+  PQfinish(conn);
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("insert_events: all checks passed\n");
+  return 0;
+}
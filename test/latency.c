@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pgq_latency.h"
+
+static int failures = 0;
+
+#define CHECK(expr) \
+  if (!(expr)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+    ++failures; \
+  }
+
+/* Tick which closed the batch, microseconds since PostgreSQL epoch */
+#define TICK_TIME           1000000000LL
+#define POSTGRES_EPOCH_USEC 946684800000000LL
+
+static batch_info_t batch;
+
+/* Records one event produced 'stamp_lag' (by stamp) and 'time_lag' (by ev_time) microseconds before the tick */
+static void record_event(const char* ev_type, int64_t stamp_lag, int64_t time_lag) {
+  event_t event;
+  memset(&event, 0, sizeof(event));
+  strcpy(event.type, ev_type);
+  event.time = TICK_TIME - time_lag;
+  snprintf(event.extra2, sizeof(event.extra2), "t:%lld", TICK_TIME + POSTGRES_EPOCH_USEC - stamp_lag);
+  latency_record_finish(&batch, &event, 1, latency_record_fetch(&batch, &event, 1));
+}
+
+static void test_buckets() {
+  latency_histogram_t h;
+
+  latency_reading_enable(2);
+  record_event("buckets", 0, 0);
+  record_event("buckets", 1, 0);
+  record_event("buckets", 1000, 0);
+  record_event("buckets", 1023, 0);
+  record_event("buckets", 1024, 0);
+  /* produce time after the tick (clock skew) is counted as 0 */
+  record_event("buckets", -5, 0);
+  CHECK(latency_get_histogram("q", "buckets", LATENCY_ENQUEUE_TO_TICK, &h) == 1);
+  CHECK(h.count == 6 && h.sum_usec == 3048 && h.max_usec == 1024);
+  CHECK(h.buckets[0] == 3);
+  CHECK(h.buckets[9] == 2);
+  CHECK(h.buckets[10] == 1);
+  CHECK(latency_get_histogram("q", "buckets", LATENCY_FETCH_TO_FINISH, &h) == 1);
+  CHECK(h.count == 6);
+}
+
+static void test_reading() {
+  latency_histogram_t h;
+
+  /* ev_time is used when reading is disabled, even if events carry stamps */
+  latency_reading_enable(0);
+  record_event("reading", 100, 5000);
+  CHECK(latency_get_histogram("q", "reading", LATENCY_ENQUEUE_TO_TICK, &h) == 1);
+  CHECK(h.max_usec == 5000 && h.buckets[12] == 1);
+
+  /* value without stamp prefix is not taken for time */
+  latency_reading_enable(1);
+  record_event("reading", 100, 7000);
+  CHECK(latency_get_histogram("q", "reading", LATENCY_ENQUEUE_TO_TICK, &h) == 1);
+  CHECK(h.max_usec == 7000 && h.buckets[12] == 2);
+
+  latency_reading_enable(2);
+  record_event("reading", 100, 7000);
+  CHECK(latency_get_histogram("q", "reading", LATENCY_ENQUEUE_TO_TICK, &h) == 1);
+  CHECK(h.count == 3 && h.buckets[6] == 1);
+}
+
+static void test_percentile() {
+  latency_histogram_t h;
+
+  memset(&h, 0, sizeof(h));
+  CHECK(latency_percentile(&h, 50) == 0);
+  h.buckets[3] = 90;
+  h.buckets[10] = 10;
+  h.count = 100;
+  h.max_usec = 1500;
+  CHECK(latency_percentile(&h, 0) == 16);
+  CHECK(latency_percentile(&h, 50) == 16);
+  CHECK(latency_percentile(&h, 89.9) == 16);
+  /* upper bound of the bucket is limited by observed maximum */
+  CHECK(latency_percentile(&h, 90) == 1500);
+  CHECK(latency_percentile(&h, 100) == 1500);
+  h.buckets[LATENCY_BUCKETS - 1] = 1;
+  h.max_usec = 1ll << 50;
+  CHECK(latency_percentile(&h, 100) == 1ll << 50);
+}
+
+static void test_series() {
+  latency_histogram_t h;
+  char ev_type[16];
+  int i, found = 0;
+
+  CHECK(latency_get_histogram("q", "missing", LATENCY_ENQUEUE_TO_TICK, &h) == 0);
+  CHECK(latency_get_histogram("q", "buckets", LATENCY_STAGES, &h) == 0);
+  strcpy(batch.queue_name, "other");
+  record_event("buckets", 10, 0);
+  CHECK(latency_get_histogram("other", "buckets", LATENCY_ENQUEUE_TO_TICK, &h) == 1 && h.count == 1);
+  CHECK(latency_get_histogram("q", "buckets", LATENCY_ENQUEUE_TO_TICK, &h) == 1 && h.count == 6);
+
+  /* table holds LATENCY_MAX_SERIES series, 3 of them are taken by the tests above */
+  for (i = 0; i < LATENCY_MAX_SERIES; ++i) {
+    snprintf(ev_type, sizeof(ev_type), "fill%d", i);
+    record_event(ev_type, 10, 0);
+  }
+  for (i = 0; i < LATENCY_MAX_SERIES; ++i) {
+    snprintf(ev_type, sizeof(ev_type), "fill%d", i);
+    found += latency_get_histogram("other", ev_type, LATENCY_ENQUEUE_TO_TICK, &h);
+  }
+  CHECK(found == LATENCY_MAX_SERIES - 3);
+  CHECK(latency_get_histogram("q", "reading", LATENCY_ENQUEUE_TO_TICK, &h) == 1);
+
+  latency_reset();
+  CHECK(latency_get_histogram("q", "buckets", LATENCY_ENQUEUE_TO_TICK, &h) == 1);
+  CHECK(h.count == 0 && h.max_usec == 0 && h.buckets[0] == 0);
+}
+
+int main(int argc, char* argv[]) {
+  memset(&batch, 0, sizeof(batch));
+  strcpy(batch.queue_name, "q");
+  batch.batch_end = TICK_TIME;
+  test_buckets();
+  test_reading();
+  test_percentile();
+  test_series();
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("latency: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pgq_backend.h"
+
+static int failures = 0;
+
+#define CHECK(expr) \
+  if (!(expr)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+    ++failures; \
+  }
+
+/* Takes next batch of the consumer, returns amount of its events and finishes it if 'finish' is set */
+static int take_batch(backend_t* backend, const char* consumer_name, batch_id_t* batch_id, event_t** events, int finish) {
+  int nevents;
+  *batch_id = backend_next_batch(backend, "q", consumer_name);
+  if (*batch_id <= 0)
+    return -1;
+  nevents = backend_get_batch_events(backend, *batch_id, events);
+  if (finish)
+    backend_finish_batch(backend, *batch_id);
+  return nevents;
+}
+
+static void test_tick_visibility(backend_t* backend) {
+  batch_info_t* info;
+  batch_id_t batch_id;
+  event_t* events;
+  tick_id_t tick_id;
+
+  CHECK(backend_register_consumer(backend, "q", "a") == 1);
+  CHECK(backend_next_batch(backend, "q", "a") == 0);
+  CHECK(backend_insert_event(backend, "q", "t", "first") > 0);
+  CHECK(backend_insert_event_ex(backend, "q", "t", "second", "x", NULL, NULL, "z") > 0);
+  /* events are not visible until tick */
+  CHECK(backend_next_batch(backend, "q", "a") == 0);
+  tick_id = backend_tick(backend, "q");
+  CHECK(tick_id > 0);
+  CHECK(take_batch(backend, "a", &batch_id, &events, 0) == 2);
+  CHECK(strcmp(events[0].data, "first") == 0);
+  CHECK(strcmp(events[1].extra1, "x") == 0 && events[1].extra2[0] == 0 && strcmp(events[1].extra4, "z") == 0);
+  free(events);
+  CHECK(backend_get_batch_info(backend, batch_id, &info) == 1);
+  CHECK(info->tick_id == tick_id && info->prev_tick_id == tick_id - 1);
+  free(info);
+  backend_finish_batch(backend, batch_id);
+}
+
+static void test_redelivery(backend_t* backend) {
+  batch_id_t batch_id;
+  event_t* events;
+
+  CHECK(backend_insert_event(backend, "q", "t", "again") > 0);
+  backend_tick(backend, "q");
+  /* batch is given again until it is finished */
+  CHECK(take_batch(backend, "a", &batch_id, &events, 0) == 1);
+  free(events);
+  CHECK(backend_next_batch(backend, "q", "a") == batch_id);
+  CHECK(backend_get_batch_events(backend, batch_id, &events) == 1);
+  CHECK(strcmp(events[0].data, "again") == 0);
+  free(events);
+  CHECK(backend_finish_batch(backend, batch_id) == 1);
+  CHECK(backend_finish_batch(backend, batch_id) == 0);
+  CHECK(backend_next_batch(backend, "q", "a") == 0);
+}
+
+static void test_retry(backend_t* backend) {
+  batch_id_t batch_id;
+  event_t* events;
+  event_id_t event_id;
+
+  CHECK(backend_register_consumer(backend, "q", "b") == 1);
+  event_id = backend_insert_event(backend, "q", "t", "retried");
+  backend_insert_event(backend, "q", "t", "done");
+  backend_tick(backend, "q");
+
+  CHECK(take_batch(backend, "a", &batch_id, &events, 0) == 2);
+  free(events);
+  CHECK(backend_event_retry(backend, batch_id, event_id, 0) == 1);
+  CHECK(backend_event_retry(backend, batch_id, event_id, 0) == 0);
+  backend_finish_batch(backend, batch_id);
+  CHECK(take_batch(backend, "b", &batch_id, &events, 1) == 2);
+  free(events);
+
+  /* retried event goes to its consumer only */
+  backend_tick(backend, "q");
+  CHECK(take_batch(backend, "a", &batch_id, &events, 0) == 1);
+  CHECK(events[0].id == event_id && events[0].retry == 1);
+  free(events);
+  CHECK(take_batch(backend, "b", &batch_id, &events, 1) == 0);
+  free(events);
+
+  /* retry which is not due yet stays out of ticks */
+  CHECK(backend_batch_retry(backend, backend_next_batch(backend, "q", "a"), 3600) == 1);
+  backend_finish_batch(backend, backend_next_batch(backend, "q", "a"));
+  backend_tick(backend, "q");
+  CHECK(take_batch(backend, "a", &batch_id, &events, 1) == 0);
+  free(events);
+  CHECK(take_batch(backend, "b", &batch_id, &events, 1) == 0);
+  free(events);
+}
+
+static void test_unregister_drops_retries(backend_t* backend) {
+  batch_id_t batch_id;
+  event_t* events;
+  int i;
+
+  backend_insert_event(backend, "q", "t", "lost");
+  backend_tick(backend, "q");
+  CHECK(take_batch(backend, "a", &batch_id, &events, 0) == 1);
+  free(events);
+  CHECK(backend_batch_retry(backend, batch_id, 0) == 1);
+  backend_finish_batch(backend, batch_id);
+  CHECK(take_batch(backend, "b", &batch_id, &events, 1) == 1);
+  free(events);
+  CHECK(backend_unregister_consumer(backend, "q", "a") == 1);
+  CHECK(backend_register_consumer(backend, "q", "a") == 1);
+  backend_tick(backend, "q");
+  CHECK(take_batch(backend, "a", &batch_id, &events, 1) == 0);
+  free(events);
+  CHECK(take_batch(backend, "b", &batch_id, &events, 1) == 0);
+  free(events);
+
+  /* dropped retries do not hold ring slots */
+  for (i = 0; i < 8; ++i)
+    CHECK(backend_insert_event(backend, "q", "t", "fill") > 0);
+  CHECK(backend_insert_event(backend, "q", "t", "overflow") == -1);
+}
+
+static void run(backend_t* backend) {
+  CHECK(backend_create_queue(backend, "q") == 1);
+  CHECK(backend_create_queue(backend, "q") == 0);
+  test_tick_visibility(backend);
+  test_redelivery(backend);
+  test_retry(backend);
+  test_unregister_drops_retries(backend);
+  CHECK(backend_drop_queue(backend, "q") == -1);
+  CHECK(backend_drop_queue_force(backend, "q") == 1);
+}
+
+int main(int argc, char* argv[]) {
+  backend_t backend;
+  char name[64];
+
+  CHECK(mem_backend_open(&backend, 2, 8) == 0);
+  run(&backend);
+  backend_close(&backend);
+
+  snprintf(name, sizeof(name), "/pgq_test_memq.%d", (int)getpid());
+  CHECK(shm_backend_open(&backend, name, 2, 8) == 1);
+  run(&backend);
+  backend_close(&backend);
+  shm_backend_unlink(name);
+
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("memq: all checks passed\n");
+  return 0;
+}